@@ -0,0 +1,134 @@
+#!/bin/sh
+# Benchmark dd over a sweep of block sizes, conversions, I/O modes,
+# sources and sinks, printing one record per run with the statistics
+# of stats=, in CSV (the default) or JSON lines.
+#
+# dd is built from dd.c next to this script, like this:
+#
+#     $CC $CFLAGS -o dd dd.c $LDLIBS
+#
+# so CFLAGS and LDLIBS have to find what dd.c includes and links with,
+# e.g. the lib/ directory and libcoreutils.a of a coreutils build.  Set
+# DD to a dd that is already built to skip this.
+#
+# The sweep is set by these variables, whose defaults are shown:
+#
+#     BENCH_DIR=/dev/shm     a tmpfs for the scratch files
+#     BENCH_BYTES=268435456  bytes copied by each run, at least one block
+#     BENCH_SIZES="512 4K 32K 256K 2M 16M 128M 256M"
+#     BENCH_CONVS="none ascii ebcdic swab block unblock sparse"
+#     BENCH_MODES="none iflag=fullblock iflag=async oflag=direct"
+#     BENCH_SOURCES="file pipe zero random"
+#     BENCH_SINKS="file pipe null"
+#     BENCH_FORMAT=csv       or json
+#
+# Conversions and modes are given as dd's conv= and flag operands,
+# with commas for several.  Runs that dd rejects, e.g. oflag=direct on
+# a file system without direct I/O, are reported on stderr and left
+# out.
+
+: ${CC=cc}
+: ${BENCH_DIR=/dev/shm}
+: ${BENCH_BYTES=268435456}
+: ${BENCH_SIZES="512 4K 32K 256K 2M 16M 128M 256M"}
+: ${BENCH_CONVS="none ascii ebcdic swab block unblock sparse"}
+: ${BENCH_MODES="none iflag=fullblock iflag=async oflag=direct"}
+: ${BENCH_SOURCES="file pipe zero random"}
+: ${BENCH_SINKS="file pipe null"}
+: ${BENCH_FORMAT=csv}
+
+case $BENCH_FORMAT in
+  csv|json) ;;
+  *) echo "$0: BENCH_FORMAT must be csv or json" >&2; exit 1 ;;
+esac
+
+tmp=$(mktemp -d "$BENCH_DIR/bench.XXXXXX") || exit 1
+bin=
+trap 'rm -rf "$tmp" $bin' 0
+trap 'exit 1' 1 2 13 15
+
+# Build dd outside BENCH_DIR, which may not allow executing files.
+if test -z "$DD"; then
+  bin=$(mktemp -d) || exit 1
+  DD=$bin/dd
+  $CC $CFLAGS -o "$DD" "$(dirname "$0")/dd.c" $LDLIBS || exit 1
+fi
+
+# The size in bytes of a block size like 32K or 2M.
+bytes ()
+{
+  case $1 in
+    *K) echo $((${1%K} * 1024)) ;;
+    *M) echo $((${1%M} * 1024 * 1024)) ;;
+    *G) echo $((${1%G} * 1024 * 1024 * 1024)) ;;
+    *) echo "$1" ;;
+  esac
+}
+
+# The input of the file and pipe sources: lines of text, so that
+# conv=block and conv=unblock find records.
+"$DD" if=/dev/urandom bs=1M count=$(((BENCH_BYTES + 1048575) / 1048576)) \
+      status=none | od -An -tx1 -w40 > "$tmp/in" || exit 1
+
+header=
+for bs in $BENCH_SIZES; do
+  n=$(bytes "$bs")
+  count=$(((BENCH_BYTES + n - 1) / n))
+  for conv in $BENCH_CONVS; do
+    ops="bs=$n count=$count cbs=80 stats=$BENCH_FORMAT status=none"
+    test "$conv" = none || ops="$ops conv=$conv"
+    for mode in $BENCH_MODES; do
+      mops=$ops
+      test "$mode" = none || mops="$ops $mode"
+      for source in $BENCH_SOURCES; do
+        case $source in
+          file) iop="if=$tmp/in" ;;
+          zero) iop="if=/dev/zero" ;;
+          random) iop="if=/dev/urandom" ;;
+          pipe) iop= ;;
+          *) echo "$0: unknown source $source" >&2; exit 1 ;;
+        esac
+        for sink in $BENCH_SINKS; do
+          case $sink in
+            file) oop="of=$tmp/out" ;;
+            null) oop="of=/dev/null" ;;
+            pipe) oop= ;;
+            *) echo "$0: unknown sink $sink" >&2; exit 1 ;;
+          esac
+          # Keep dd's exit status, which a pipeline loses.
+          rm -f "$tmp/out"
+          if test $source = pipe; then
+            cat "$tmp/in" \
+              | { "$DD" $oop $mops 2> "$tmp/stats"; echo $? > "$tmp/status"; } \
+              | cat > /dev/null
+          elif test $sink = pipe; then
+            { "$DD" $iop $mops 2> "$tmp/stats"; echo $? > "$tmp/status"; } \
+              | cat > /dev/null
+          else
+            "$DD" $iop $oop $mops 2> "$tmp/stats"
+            echo $? > "$tmp/status"
+          fi
+          if test "$(cat "$tmp/status")" -ne 0; then
+            echo "$0: failed: $iop $oop $mops" >&2
+            sed 's/^/  /' "$tmp/stats" >&2
+            continue
+          fi
+
+          record=$(tail -n 1 "$tmp/stats")
+          if test $BENCH_FORMAT = csv; then
+            if test -z "$header"; then
+              header=$(tail -n 2 "$tmp/stats" | head -n 1)
+              echo "source,sink,bs,conv,mode,$header"
+            fi
+            echo "$source,$sink,$n,$conv,$mode,$record"
+          else
+            printf '{"source": "%s", "sink": "%s", "bs": %s, ' \
+                   "$source" "$sink" "$n"
+            printf '"conv": "%s", "mode": "%s", "stats": %s}\n' \
+                   "$conv" "$mode" "$record"
+          fi
+        done
+      done
+    done
+  done
+done
@@ -23,6 +23,27 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#ifdef __linux__
+# include <sys/sendfile.h>
+# include <sys/syscall.h>
+# include <linux/errqueue.h>
+# include <linux/futex.h>
+# include <linux/perf_event.h>
+#endif
+#if defined __x86_64__ || defined __i386__
+# include <x86intrin.h>
+#endif
 
 #include "system.h"
 #include "close-stream.h"
@@ -30,12 +51,40 @@
 #include "fd-reopen.h"
 #include "gethrxtime.h"
 #include "human.h"
+#include "ignore-value.h"
 #include "long-options.h"
+#include "nproc.h"
 #include "quote.h"
 #include "verror.h"
 #include "xstrtol.h"
 #include "xtime.h"
 
+/* The compressed formats need libraries that configure does not check
+   for, so enable them when building: -DHAVE_ZSTD=1 with -lzstd for
+   oflag=zstd, oflag=zstd-seekable and zstd input, -DHAVE_LZ4=1 with
+   -llz4 for oflag=lz4 and lz4 input, -DHAVE_ZLIB=1 with -lz for gzip
+   input, and -DHAVE_LZMA=1 with -llzma for xz input.  */
+#if HAVE_ZSTD
+# include <zstd.h>
+#endif
+#if HAVE_LZ4
+# include <lz4frame.h>
+#endif
+#if HAVE_ZLIB
+# include <zlib.h>
+#endif
+#if HAVE_LZMA
+# include <lzma.h>
+#endif
+
+#define HAVE_DECOMPRESSION (HAVE_ZLIB || HAVE_LZMA || HAVE_ZSTD || HAVE_LZ4)
+
+#if defined __linux__ && defined MSG_ZEROCOPY && defined SO_ZEROCOPY
+# define HAVE_ZEROCOPY 1
+#else
+# define HAVE_ZEROCOPY 0
+#endif
+
 /* The official name of this program (e.g., no 'g' prefix).  */
 #define PROGRAM_NAME "dd"
 
@@ -75,7 +124,35 @@
 #undef O_NOCACHE
 
 #if ! HAVE_FDATASYNC
-# define fdatasync(fd) (errno = ENOSYS, -1)
+static int
+fdatasync (int fd)
+{
+  errno = ENOSYS;
+  return -1;
+}
+#endif
+
+#if ! HAVE_FALLOCATE
+static int
+fallocate (int fd, int mode, off_t offset, off_t len)
+{
+  errno = ENOSYS;
+  return -1;
+}
+#endif
+
+#ifndef FALLOC_FL_KEEP_SIZE
+# define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+
+#if ! HAVE_POSIX_FADVISE
+# define POSIX_FADV_DONTNEED 0
+static int
+posix_fadvise (int fd, off_t offset, off_t len, int advice)
+{
+  errno = ENOTSUP;
+  return -1;
+}
 #endif
 
 #define output_char(c)				\
@@ -90,9 +167,9 @@
 /* Default input and output blocksize. */
 #define DEFAULT_BLOCKSIZE 512
 
-/* How many bytes to add to the input and output block sizes before invoking
-   malloc.  See dd_copy for details.  INPUT_BLOCK_SLOP must be no less than
-   OUTPUT_BLOCK_SLOP.  */
+/* How many bytes to allow for on top of the input and output block sizes
+   when allocating buffers.  See dd_copy and buffer_get for details.
+   INPUT_BLOCK_SLOP must be no less than OUTPUT_BLOCK_SLOP.  */
 #define INPUT_BLOCK_SLOP (2 * SWAB_ALIGN_OFFSET + 2 * page_size - 1)
 #define OUTPUT_BLOCK_SLOP (page_size - 1)
 
@@ -131,6 +208,25 @@ enum
     C_SPARSE = 0200000
   };
 
+/* I/O scheduling classes, for ioprio="...".  These match the
+   IOPRIO_CLASS_* values of the Linux ioprio_set system call.  */
+enum
+  {
+    IOPRIO_CLASS_RT = 1,
+    IOPRIO_CLASS_BE = 2,
+    IOPRIO_CLASS_IDLE = 3
+  };
+
+/* Highest priority level within an I/O scheduling class.  */
+#define IOPRIO_LEVEL_MAX 7
+
+/* Highest NUMA node number accepted by numa=.  */
+#define NUMA_NODE_MAX 1023
+
+/* Longest delay inserted before a write when throttling output
+   to meet 'latency-target'.  */
+#define MAX_WRITE_DELAY XTIME_PRECISION
+
 /* Status levels.  */
 enum
   {
@@ -140,12 +236,34 @@ enum
     STATUS_PROGRESS = 4
   };
 
+/* Machine-readable statistics formats, for stats="...".  */
+enum
+  {
+    STATS_CSV = 1,
+    STATS_JSON = 2
+  };
+/* Output compression formats, for oflag=zstd, oflag=zstd-seekable
+   and oflag=lz4.  */
+enum
+  {
+    COMPRESS_ZSTD = 1,
+    COMPRESS_LZ4 = 2,
+    COMPRESS_ZSTD_SEEKABLE = 3
+  };
+
 /* The name of the input file, or NULL for the standard input. */
 static char const *input_file = NULL;
 
 /* The name of the output file, or NULL for the standard output. */
 static char const *output_file = NULL;
 
+/* The output files after the first, from further of= operands with
+   oflag=tee, the file descriptors they are open on, and how many there
+   are.  */
+static char const **extra_output_files;
+static int *extra_output_fds;
+static size_t n_extra_outputs;
+
 /* The page size on this host.  */
 static size_t page_size;
 
@@ -172,6 +290,13 @@ static uintmax_t seek_records = 0;
    output.  */
 static uintmax_t seek_bytes = 0;
 
+/* Whether the output must be truncated to the offset given by seek=.  */
+static bool truncate_output;
+
+/* The number of bytes to reserve after the seek= offset of the output,
+   for oflag=prealloc.  */
+static uintmax_t preallocate_size;
+
 /* Whether the final output was done with a seek (rather than a write).  */
 static bool final_op_was_seek;
 
@@ -191,6 +316,9 @@ static int output_flags = 0;
 /* Status flags for what is printed to stderr.  */
 static int status_level = STATUS_DEFAULT;
 
+/* Format of the final machine-readable statistics, or 0 for none.  */
+static int stats_format = 0;
+
 /* If nonzero, filter characters through the translation table.  */
 static bool translation_needed = false;
 
@@ -209,12 +337,43 @@ static uintmax_t r_full = 0;
 /* Number of bytes written.  */
 static uintmax_t w_bytes = 0;
 
+/* Number of read and write system calls issued.  Helper threads that
+   read the input count them too.  */
+static atomic_uintmax_t r_syscalls = 0;
+static atomic_uintmax_t w_syscalls = 0;
+
+/* Performance counter of the CPU cycles used by dd, or -1 if
+   not available.  */
+static int cycles_fd = -1;
+
 /* Time that dd started.  */
 static xtime_t start_time;
 
 /* Previous time for periodic progress.  */
 static xtime_t previous_time;
 
+/* Target latency of each write to the output, or 0 if output is
+   not throttled.  */
+static xtime_t latency_target;
+
+/* Moving average of recent output write latencies.  */
+static xtime_t write_latency;
+
+/* Delay currently inserted before each write to the output.  */
+static xtime_t write_delay;
+
+/* I/O scheduling class and level to run under, or 0 to leave them
+   unchanged.  */
+static int ioprio_class;
+static int ioprio_level;
+
+/* NUMA node to allocate buffers on and run on, or -1 to leave the
+   placement to the system.  */
+static int numa_node = -1;
+
+/* Whether to use the NUMA node of the input or output device.  */
+static bool numa_auto;
+
 /* Whether a '\n' is pending after writing progress.  */
 static bool newline_pending;
 
@@ -253,9 +412,16 @@ static size_t oc = 0;
 /* Index into current line, for 'conv=block' and 'conv=unblock'.  */
 static size_t col = 0;
 
+/* Spaces read but not yet output, for 'conv=unblock'.  */
+static size_t pending_spaces = 0;
+
 /* The set of signals that are caught.  */
 static sigset_t caught_signals;
 
+/* The thread that handles caught signals.  Helper threads leave
+   them to it.  */
+static pthread_t main_thread;
+
 /* If nonzero, the value of the pending fatal signal.  */
 static sig_atomic_t volatile interrupt_signal;
 
@@ -265,11 +431,56 @@ static sig_atomic_t volatile info_signal_count;
 /* Whether to discard cache for input or output.  */
 static bool i_nocache, o_nocache;
 
+/* Whether to decompress the input.  */
+static bool i_decompress;
+
+/* Whether a reader thread reads the input ahead, for iflag=async.  */
+static bool i_async;
+
+/* Whether if= and of= name socket endpoints rather than files, for
+   iflag=socket and oflag=socket.  */
+static bool i_socket;
+static bool o_socket;
+
+/* Whether to send whole output blocks to the output socket with
+   MSG_ZEROCOPY, which lends the pages of the buffer to the output; and
+   whether IBUF has been lent since it was last replaced.  */
+static bool o_zerocopy;
+static bool ibuf_lent;
+
+#if HAVE_ZEROCOPY
+/* The number of MSG_ZEROCOPY sends made, which is one more than the
+   number the kernel gave the last in its notifications, and the number
+   that have completed.  Both wrap around.  */
+static uint32_t zerocopy_sent;
+static uint32_t zerocopy_done;
+
+/* Buffers lent to the output socket, oldest first, each with the
+   number of the last send made from it.  Writes smaller than
+   ZEROCOPY_MIN are copied, as tracking them would cost more.  */
+enum { ZEROCOPY_LENT_MAX = 32, ZEROCOPY_MIN = 16 * 1024 };
+static struct
+{
+  char *buf;
+  uint32_t last_send;
+} zerocopy_lent[ZEROCOPY_LENT_MAX];
+static size_t zerocopy_lent_head;
+static size_t zerocopy_lent_count;
+#endif
+
+/* Compression format of the output, or 0 to write it as it is.  */
+static int output_compression;
+
+#if HAVE_ZSTD
+/* zstd compression level from oflag=zstd:LEVEL, or 0 for the default.  */
+static int zstd_level;
+#endif
+
 /* Function used for read (to handle iflag=fullblock parameter).  */
 static ssize_t (*iread_fnc) (int fd, char *buf, size_t size);
 
 /* A longest symbol in the struct symbol_values tables below.  */
-#define LONGEST_SYMBOL "count_bytes"
+#define LONGEST_SYMBOL "zstd-seekable"
 
 /* A symbol and the corresponding integer value.  */
 struct symbol_value
@@ -334,7 +545,31 @@ enum
     O_SKIP_BYTES = FFS_MASK (v4),
     v5 = v4 ^ O_SKIP_BYTES,
 
-    O_SEEK_BYTES = FFS_MASK (v5)
+    O_SEEK_BYTES = FFS_MASK (v5),
+    v6 = v5 ^ O_SEEK_BYTES,
+
+    O_PREALLOC = FFS_MASK (v6),
+    v7 = v6 ^ O_PREALLOC,
+
+    O_ZSTD = FFS_MASK (v7),
+    v8 = v7 ^ O_ZSTD,
+
+    O_LZ4 = FFS_MASK (v8),
+    v9 = v8 ^ O_LZ4,
+
+    O_DECOMPRESS = FFS_MASK (v9),
+    v10 = v9 ^ O_DECOMPRESS,
+
+    O_ZSTD_SEEKABLE = FFS_MASK (v10),
+    v11 = v10 ^ O_ZSTD_SEEKABLE,
+
+    O_ASYNC_READ = FFS_MASK (v11),
+    v12 = v11 ^ O_ASYNC_READ,
+
+    O_TEE = FFS_MASK (v12),
+    v13 = v12 ^ O_TEE,
+
+    O_SOCKET = FFS_MASK (v13)
   };
 
 /* Ensure that we got something.  */
@@ -343,6 +578,14 @@ verify (O_NOCACHE != 0);
 verify (O_COUNT_BYTES != 0);
 verify (O_SKIP_BYTES != 0);
 verify (O_SEEK_BYTES != 0);
+verify (O_PREALLOC != 0);
+verify (O_ZSTD != 0);
+verify (O_LZ4 != 0);
+verify (O_DECOMPRESS != 0);
+verify (O_ZSTD_SEEKABLE != 0);
+verify (O_ASYNC_READ != 0);
+verify (O_TEE != 0);
+verify (O_SOCKET != 0);
 
 #define MULTIPLE_BITS_SET(i) (((i) & ((i) - 1)) != 0)
 
@@ -352,6 +595,14 @@ verify ( ! MULTIPLE_BITS_SET (O_NOCACHE));
 verify ( ! MULTIPLE_BITS_SET (O_COUNT_BYTES));
 verify ( ! MULTIPLE_BITS_SET (O_SKIP_BYTES));
 verify ( ! MULTIPLE_BITS_SET (O_SEEK_BYTES));
+verify ( ! MULTIPLE_BITS_SET (O_PREALLOC));
+verify ( ! MULTIPLE_BITS_SET (O_ZSTD));
+verify ( ! MULTIPLE_BITS_SET (O_LZ4));
+verify ( ! MULTIPLE_BITS_SET (O_DECOMPRESS));
+verify ( ! MULTIPLE_BITS_SET (O_ZSTD_SEEKABLE));
+verify ( ! MULTIPLE_BITS_SET (O_ASYNC_READ));
+verify ( ! MULTIPLE_BITS_SET (O_TEE));
+verify ( ! MULTIPLE_BITS_SET (O_SOCKET));
 
 /* Flags, for iflag="..." and oflag="...".  */
 static struct symbol_value const flags[] =
@@ -374,6 +625,20 @@ static struct symbol_value const flags[] =
   {"count_bytes", O_COUNT_BYTES},
   {"skip_bytes",  O_SKIP_BYTES},
   {"seek_bytes",  O_SEEK_BYTES},
+  {"prealloc",    O_PREALLOC},
+  {"async",	  O_ASYNC_READ},
+  {"tee",	  O_TEE},
+  {"socket",	  O_SOCKET},
+#if HAVE_ZSTD
+  {"zstd",	  O_ZSTD},
+  {"zstd-seekable", O_ZSTD_SEEKABLE},
+#endif
+#if HAVE_LZ4
+  {"lz4",	  O_LZ4},
+#endif
+#if HAVE_DECOMPRESSION
+  {"decompress",  O_DECOMPRESS},
+#endif
   {"",		0}
 };
 
@@ -386,6 +651,23 @@ static struct symbol_value const statuses[] =
   {"",		0}
 };
 
+/* Statistics formats, for stats="...".  */
+static struct symbol_value const stats_formats[] =
+{
+  {"csv",	STATS_CSV},
+  {"json",	STATS_JSON},
+  {"",		0}
+};
+
+/* I/O scheduling classes, for ioprio="...".  */
+static struct symbol_value const ioprio_classes[] =
+{
+  {"rt",	IOPRIO_CLASS_RT},
+  {"be",	IOPRIO_CLASS_BE},
+  {"idle",	IOPRIO_CLASS_IDLE},
+  {"",		0}
+};
+
 /* Translation table formed by applying successive transformations. */
 static unsigned char trans_table[256];
 
@@ -568,11 +850,20 @@ Copy a file, converting and formatting according to the operands.\n\
       fputs (_("\
   if=FILE         read from FILE instead of stdin\n\
   iflag=FLAGS     read as per the comma separated symbol list\n\
+  ioprio=CLASS[:LEVEL]  run with I/O scheduling CLASS ('rt', 'be' or 'idle')\n\
+                  and priority LEVEL (0 highest to 7 lowest)\n\
+  latency-target=MS  slow down writing whenever the average output write\n\
+                  latency exceeds MS milliseconds\n\
+  numa=NODE       allocate buffers on NUMA node NODE and run on its CPUs;\n\
+                  'auto' uses the node of the input or output device\n\
   obs=BYTES       write BYTES bytes at a time (default: 512)\n\
-  of=FILE         write to FILE instead of stdout\n\
+  of=FILE         write to FILE instead of stdout; with oflag=tee,\n\
+                  repeat to write the same data to several files\n\
   oflag=FLAGS     write as per the comma separated symbol list\n\
   seek=N          skip N obs-sized blocks at start of output\n\
   skip=N          skip N ibs-sized blocks at start of input\n\
+  stats=FORMAT    also print final statistics, including system calls\n\
+                  and CPU cycles per byte, in FORMAT 'csv' or 'json'\n\
   status=LEVEL    The LEVEL of information to print to stderr;\n\
                   'none' suppresses everything but error messages,\n\
                   'noxfer' suppresses the final transfer statistics,\n\
@@ -584,6 +875,10 @@ N and BYTES may be followed by the following multiplicative suffixes:\n\
 c =1, w =2, b =512, kB =1000, K =1024, MB =1000*1000, M =1024*1024, xM =M\n\
 GB =1000*1000*1000, G =1024*1024*1024, and so on for T, P, E, Z, Y.\n\
 \n\
+With iflag=socket or oflag=socket, FILE is a socket, unix:PATH or\n\
+tcp:HOST:PORT.  of= connects to it; if= listens on it and accepts a single\n\
+connection.  An if=tcp::PORT listens on the loopback interface only.\n\
+\n\
 Each CONV symbol may be:\n\
 \n\
 "), stdout);
@@ -654,6 +949,31 @@ Each FLAG symbol may be:\n\
       if (O_SEEK_BYTES)
         fputs (_("  seek_bytes  treat 'seek=N' as a byte count (oflag only)\n\
 "), stdout);
+      if (O_PREALLOC)
+        fputs (_("  prealloc  reserve space for the expected output (oflag only)\n\
+"), stdout);
+      fputs (_("  async     read ahead on a separate thread (iflag only)\n\
+"), stdout);
+      fputs (_("  tee       write to every of= FILE, not just the last\n\
+            (oflag only)\n\
+"), stdout);
+      fputs (_("  socket    FILE is a socket, unix:PATH or tcp:HOST:PORT\n\
+"), stdout);
+#if HAVE_ZSTD
+      fputs (_("  zstd[:LEVEL]  compress the output with zstd (oflag only)\n\
+"), stdout);
+      fputs (_("  zstd-seekable[:LEVEL]  compress the output as seekable zstd,\n\
+                so that iflag=decompress can skip= in it (oflag only)\n\
+"), stdout);
+#endif
+#if HAVE_LZ4
+      fputs (_("  lz4       compress the output with lz4 (oflag only)\n\
+"), stdout);
+#endif
+#if HAVE_DECOMPRESSION
+      fputs (_("  decompress  decompress gzip, zstd, xz or lz4 input (iflag only)\n\
+"), stdout);
+#endif
 
       {
         printf (_("\
@@ -683,6 +1003,111 @@ human_size (size_t n)
   return human_readable (n, hbuf, human_opts, 1, 1);
 }
 
+/* I/O buffers come from a pool of page-aligned mappings, so that big
+   buffers do not fragment the heap, and a buffer that is given back
+   is reused for the next request of the same size.  Each buffer is
+   preceded by a page that holds its header, leaving room for the
+   bytes that conv=swab writes just before the buffer, and its size is
+   rounded up to whole pages with at least SWAB_ALIGN_OFFSET bytes to
+   spare after it.  With DD_BUFFER_GUARDS, inaccessible pages on either
+   side catch overruns.  */
+
+struct buffer_header
+{
+  /* The next free buffer in the pool.  */
+  struct buffer_header *next;
+
+  /* The size that the buffer was asked for, and of its mapping.  */
+  size_t size;
+  size_t map_size;
+};
+
+/* Free buffers.  */
+static struct buffer_header *buffer_pool;
+static pthread_mutex_t buffer_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef DD_BUFFER_GUARDS
+# define BUFFER_GUARD_PAGES 1
+#else
+# define BUFFER_GUARD_PAGES 0
+#endif
+
+/* Return a page-aligned buffer of SIZE bytes, or NULL if out of
+   memory.  */
+
+static char *
+buffer_get (size_t size)
+{
+  struct buffer_header **p;
+  struct buffer_header *h;
+  size_t data_size;
+  size_t map_size;
+  char *map;
+
+  pthread_mutex_lock (&buffer_pool_lock);
+  for (p = &buffer_pool; *p; p = &(*p)->next)
+    if ((*p)->size == size)
+      {
+        h = *p;
+        *p = h->next;
+        pthread_mutex_unlock (&buffer_pool_lock);
+        return (char *) h + page_size;
+      }
+  pthread_mutex_unlock (&buffer_pool_lock);
+
+  if (SIZE_MAX - 2 * page_size * (1 + BUFFER_GUARD_PAGES) < size)
+    return NULL;
+  data_size = (size + SWAB_ALIGN_OFFSET + page_size - 1) / page_size * page_size;
+  map_size = data_size + page_size * (1 + 2 * BUFFER_GUARD_PAGES);
+  map = mmap (NULL, map_size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+
+#ifdef DD_BUFFER_GUARDS
+  mprotect (map, page_size, PROT_NONE);
+  mprotect (map + map_size - page_size, page_size, PROT_NONE);
+#endif
+
+  h = (struct buffer_header *) (map + BUFFER_GUARD_PAGES * page_size);
+  h->size = size;
+  h->map_size = map_size;
+  return (char *) h + page_size;
+}
+
+/* Give BUF, from buffer_get, back to the pool.  Let the kernel take
+   back its pages while it is not in use.  */
+
+static void
+buffer_put (char *buf)
+{
+  struct buffer_header *h = (struct buffer_header *) (buf - page_size);
+  size_t data_size = h->map_size - page_size * (1 + 2 * BUFFER_GUARD_PAGES);
+
+#ifdef MADV_FREE
+  madvise (buf, data_size, MADV_FREE);
+#else
+  madvise (buf, data_size, MADV_DONTNEED);
+#endif
+
+  pthread_mutex_lock (&buffer_pool_lock);
+  h->next = buffer_pool;
+  buffer_pool = h;
+  pthread_mutex_unlock (&buffer_pool_lock);
+}
+
+/* Unmap BUF, from buffer_get, whose pages have been lent to the
+   output.  The kernel holds references of its own to the pages until
+   it is done with them, but they must never come back to the pool
+   while it may still be, as they would be written to again.  */
+
+static void
+buffer_drop (char *buf)
+{
+  struct buffer_header *h = (struct buffer_header *) (buf - page_size);
+  munmap ((char *) h - BUFFER_GUARD_PAGES * page_size, h->map_size);
+}
+
 /* Ensure input buffer IBUF is allocated.  */
 
 static void
@@ -691,15 +1116,11 @@ alloc_ibuf (void)
   if (ibuf)
     return;
 
-  char *real_buf = malloc (input_blocksize + INPUT_BLOCK_SLOP);
-  if (!real_buf)
+  ibuf = buffer_get (input_blocksize);
+  if (!ibuf)
     error (EXIT_FAILURE, 0,
            _("memory exhausted by input buffer of size %"PRIuMAX" bytes (%s)"),
            (uintmax_t) input_blocksize, human_size (input_blocksize));
-
-  real_buf += SWAB_ALIGN_OFFSET;	/* allow space for swab */
-
-  ibuf = ptr_align (real_buf, page_size);
 }
 
 /* Ensure output buffer OBUF is allocated/initialized.  */
@@ -712,14 +1133,12 @@ alloc_obuf (void)
 
   if (conversions_mask & C_TWOBUFS)
     {
-      /* Page-align the output buffer, too.  */
-      char *real_obuf = malloc (output_blocksize + OUTPUT_BLOCK_SLOP);
-      if (!real_obuf)
+      obuf = buffer_get (output_blocksize);
+      if (!obuf)
         error (EXIT_FAILURE, 0,
                _("memory exhausted by output buffer of size %"PRIuMAX
                  " bytes (%s)"),
                (uintmax_t) output_blocksize, human_size (output_blocksize));
-      obuf = ptr_align (real_obuf, page_size);
     }
   else
     {
@@ -835,6 +1254,92 @@ print_stats (void)
   print_xfer_stats (0);
 }
 
+/* Start counting the CPU cycles used by dd and any threads it starts.
+   Count kernel cycles too if permitted, as most of dd's work is
+   done in system calls.  */
+
+static void
+start_cycle_counter (void)
+{
+#if defined __linux__ && defined SYS_perf_event_open
+  struct perf_event_attr attr;
+  memset (&attr, 0, sizeof attr);
+  attr.size = sizeof attr;
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  attr.inherit = 1;
+  attr.exclude_hv = 1;
+
+  cycles_fd = syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (cycles_fd < 0)
+    {
+      attr.exclude_kernel = 1;
+      cycles_fd = syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+/* Print the final statistics in the machine-readable 'stats_format'.
+   Quantities that could not be measured are left empty.  */
+
+static void
+print_machine_stats (void)
+{
+  double XTIME_PRECISIONe0 = XTIME_PRECISION;
+  double delta_s = (gethrxtime () - start_time) / XTIME_PRECISIONe0;
+  double gbytes = w_bytes / 1e9;
+  uintmax_t syscalls = r_syscalls + w_syscalls;
+
+  struct rusage usage;
+  double cpu_s = 0;
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    cpu_s = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+             + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6);
+
+  char cycles_per_byte[32] = "";
+  uint64_t cycles;
+  if (0 <= cycles_fd && w_bytes
+      && read (cycles_fd, &cycles, sizeof cycles) == sizeof cycles)
+    snprintf (cycles_per_byte, sizeof cycles_per_byte, "%.4f",
+              (double) cycles / w_bytes);
+
+  char gb_per_s[32] = "";
+  if (0 < delta_s)
+    snprintf (gb_per_s, sizeof gb_per_s, "%.6f", gbytes / delta_s);
+
+  char syscalls_per_gb[32] = "";
+  if (w_bytes)
+    snprintf (syscalls_per_gb, sizeof syscalls_per_gb, "%.1f",
+              syscalls / gbytes);
+
+  if (stats_format == STATS_CSV)
+    fprintf (stderr,
+             "bytes,seconds,records_in_full,records_in_partial,"
+             "records_out_full,records_out_partial,read_syscalls,"
+             "write_syscalls,syscalls_per_gb,gb_per_s,cpu_seconds,"
+             "cycles_per_byte\n"
+             "%"PRIuMAX",%.6f,%"PRIuMAX",%"PRIuMAX",%"PRIuMAX",%"PRIuMAX
+             ",%"PRIuMAX",%"PRIuMAX",%s,%s,%.6f,%s\n",
+             w_bytes, delta_s, r_full, r_partial, w_full, w_partial,
+             r_syscalls, w_syscalls, syscalls_per_gb, gb_per_s, cpu_s,
+             cycles_per_byte);
+  else
+    fprintf (stderr,
+             "{\"bytes\": %"PRIuMAX", \"seconds\": %.6f, "
+             "\"records_in_full\": %"PRIuMAX", "
+             "\"records_in_partial\": %"PRIuMAX", "
+             "\"records_out_full\": %"PRIuMAX", "
+             "\"records_out_partial\": %"PRIuMAX", "
+             "\"read_syscalls\": %"PRIuMAX", \"write_syscalls\": %"PRIuMAX", "
+             "\"syscalls_per_gb\": %s, \"gb_per_s\": %s, "
+             "\"cpu_seconds\": %.6f, \"cycles_per_byte\": %s}\n",
+             w_bytes, delta_s, r_full, r_partial, w_full, w_partial,
+             r_syscalls, w_syscalls,
+             *syscalls_per_gb ? syscalls_per_gb : "null",
+             *gb_per_s ? gb_per_s : "null", cpu_s,
+             *cycles_per_byte ? cycles_per_byte : "null");
+}
+
 /* An ordinary signal was received; arrange for the program to exit.  */
 
 static void
@@ -918,6 +1423,16 @@ cleanup (void)
   if (close (STDOUT_FILENO) < 0)
     error (EXIT_FAILURE, errno,
            _("closing output file %s"), quoteaf (output_file));
+
+  /* Count the extra outputs down as they are closed, so that none is
+     closed twice if a signal arrives while dd is finishing up.  */
+  while (n_extra_outputs)
+    {
+      n_extra_outputs--;
+      if (close (extra_output_fds[n_extra_outputs]) < 0)
+        error (EXIT_FAILURE, errno, _("closing output file %s"),
+               quoteaf (extra_output_files[n_extra_outputs]));
+    }
 }
 
 /* Process any pending signals.  If signals are caught, this function
@@ -927,6 +1442,9 @@ cleanup (void)
 static void
 process_signals (void)
 {
+  if (! pthread_equal (pthread_self (), main_thread))
+    return;
+
   while (interrupt_signal || info_signal_count)
     {
       int interrupt;
@@ -953,11 +1471,30 @@ process_signals (void)
     }
 }
 
+/* Run ROUTINE (ARG) on a new thread, which leaves the caught signals
+   to the main thread.  Return true if the thread was started.  */
+
+static bool
+start_thread (pthread_t *thread, void *(*routine) (void *), void *arg)
+{
+#if SA_NOCLDSTOP
+  sigset_t oldset;
+  pthread_sigmask (SIG_BLOCK, &caught_signals, &oldset);
+#endif
+  bool started = pthread_create (thread, NULL, routine, arg) == 0;
+#if SA_NOCLDSTOP
+  pthread_sigmask (SIG_SETMASK, &oldset, NULL);
+#endif
+  return started;
+}
+
 static void
 finish_up (void)
 {
   cleanup ();
   print_stats ();
+  if (stats_format)
+    print_machine_stats ();
   process_signals ();
 }
 
@@ -968,906 +1505,5328 @@ quit (int code)
   exit (code);
 }
 
-/* Return LEN rounded down to a multiple of PAGE_SIZE
-   while storing the remainder internally per FD.
-   Pass LEN == 0 to get the current remainder.  */
+/* An I/O backend: the operations dd uses to move data in and out of
+   a file, and to position, size and flush it.  Each has the interface
+   of the like-named POSIX function.  A backend is chosen for the input
+   and for the output when they are opened, so that engines suited to
+   the file type can be substituted without touching dd_copy.  */
 
-static off_t
-cache_round (int fd, off_t len)
+struct io_backend
 {
-  static off_t i_pending, o_pending;
-  off_t *pending = (fd == STDIN_FILENO ? &i_pending : &o_pending);
+  ssize_t (*read) (int fd, void *buf, size_t size);
+  ssize_t (*write) (int fd, void const *buf, size_t size);
+  off_t (*lseek) (int fd, off_t offset, int whence);
+  int (*ftruncate) (int fd, off_t length);
+  int (*fstat) (int fd, struct stat *st);
+  int (*fdatasync) (int fd);
+  int (*fsync) (int fd);
+  int (*fadvise) (int fd, off_t offset, off_t len, int advice);
+  int (*fallocate) (int fd, int mode, off_t offset, off_t len);
+
+  /* Write out anything still buffered for FD, at the end of the
+     output.  */
+  int (*finish) (int fd);
+};
 
-  if (len)
-    {
-      uintmax_t c_pending = *pending + len;
-      *pending = c_pending % page_size;
-      if (c_pending > *pending)
-        len = c_pending - *pending;
-      else
-        len = 0;
-    }
-  else
-    len = *pending;
+/* The finish operation of backends that buffer nothing.  */
+static int
+finish_nothing (int fd _GL_UNUSED)
+{
+  return 0;
+}
 
-  return len;
+/* Read and write with the system calls, counting them.  Backends that
+   do not simply pass the data through count only the calls that they
+   end up making, if any.  */
+
+static ssize_t
+sys_read (int fd, void *buf, size_t size)
+{
+  r_syscalls++;
+  return read (fd, buf, size);
 }
 
-/* Discard the cache from the current offset of either
-   STDIN_FILENO or STDOUT_FILENO.
-   Return true on success.  */
+static ssize_t
+sys_write (int fd, void const *buf, size_t size)
+{
+  w_syscalls++;
+  return write (fd, buf, size);
+}
 
-static bool
-invalidate_cache (int fd, off_t len)
+/* The plain system calls.  */
+static struct io_backend const posix_io =
 {
-  int adv_ret = -1;
+  .read = sys_read,
+  .write = sys_write,
+  .lseek = lseek,
+  .ftruncate = ftruncate,
+  .fstat = fstat,
+  .fdatasync = fdatasync,
+  .fsync = fsync,
+  .fadvise = posix_fadvise,
+  .fallocate = fallocate,
+  .finish = finish_nothing
+};
 
-  /* Minimize syscalls.  */
-  off_t clen = cache_round (fd, len);
-  if (len && !clen)
-    return true; /* Don't advise this time.  */
-  if (!len && !clen && max_records)
-    return true; /* Nothing pending.  */
-  off_t pending = len ? cache_round (fd, 0) : 0;
+/* The backends of the input and the output.  */
+static struct io_backend const *input_backend = &posix_io;
+static struct io_backend const *output_backend = &posix_io;
+
+/* Return the backend of FD, which is the input or the output.  */
+
+static inline struct io_backend const *
+fd_backend (int fd)
+{
+  return fd == STDIN_FILENO ? input_backend : output_backend;
+}
+
+#ifdef DD_FAULT_INJECTION
+
+/* For testing, a backend that injects faults at given file offsets,
+   as listed in the DD_FAULTS environment variable.  This makes the
+   error recovery paths (conv=noerror, conv=sync, partial read and
+   write handling) reproducible.  */
+
+/* Kinds of fault, for DD_FAULTS="KIND[@OFFSET],...".  */
+enum
+  {
+    F_SHORT = 1,	/* Input read ends at OFFSET.  */
+    F_EINTR,		/* Input read covering OFFSET is interrupted.  */
+    F_EIO,		/* Input read covering OFFSET fails with EIO.  */
+    F_ENOSPC,		/* Output write covering OFFSET fails with ENOSPC.  */
+    F_LSEEK		/* Input seeks fail, as with the tape lseek bug.  */
+  };
 
+static struct symbol_value const fault_kinds[] =
+{
+  {"short",	F_SHORT},
+  {"eintr",	F_EINTR},
+  {"eio",	F_EIO},
+  {"enospc",	F_ENOSPC},
+  {"lseek",	F_LSEEK},
+  {"",		0}
+};
+
+static struct fault
+{
+  int kind;
+  uintmax_t offset;
+  bool done;
+} *faults;
+static size_t n_faults;
+
+/* If nonzero, the state of a pseudo-random sequence used to shorten
+   every read of the input.  From the DD_SHORT_READS environment
+   variable.  */
+static unsigned int short_read_seed;
+
+/* If true, copy with reference_copy instead of dd_copy, so that the
+   two can be compared.  From the DD_REFERENCE environment variable.  */
+static bool use_reference_copy;
+
+/* Offsets of the input and output as seen through the backend,
+   indexed by file descriptor.  */
+static uintmax_t fault_offset[2];
+
+/* Return the first pending fault of KIND in the SIZE bytes at the
+   current offset of FD, or NULL if there is none.  */
+
+static struct fault *
+find_fault (int fd, int kind, size_t size)
+{
+  uintmax_t start = fault_offset[fd];
+  size_t i;
+
+  for (i = 0; i < n_faults; i++)
+    if (faults[i].kind == kind && ! faults[i].done
+        && start <= faults[i].offset && faults[i].offset - start < size)
+      return &faults[i];
+  return NULL;
+}
+
+static ssize_t
+fault_read (int fd, void *buf, size_t size)
+{
   if (fd == STDIN_FILENO)
     {
-      if (input_seekable)
+      struct fault *f;
+
+      if (short_read_seed && 1 < size)
+        size = 1 + rand_r (&short_read_seed) % size;
+
+      if ((f = find_fault (fd, F_EINTR, size))
+          || (f = find_fault (fd, F_EIO, size)))
         {
-          /* Note we're being careful here to only invalidate what
-             we've read, so as not to dump any read ahead cache.  */
-#if HAVE_POSIX_FADVISE
-            adv_ret = posix_fadvise (fd, input_offset - clen - pending, clen,
-                                     POSIX_FADV_DONTNEED);
-#else
-            errno = ENOTSUP;
-#endif
+          f->done = true;
+          errno = f->kind == F_EINTR ? EINTR : EIO;
+          return -1;
         }
-      else
-        errno = ESPIPE;
-    }
-  else if (fd == STDOUT_FILENO)
-    {
-      static off_t output_offset = -2;
-
-      if (output_offset != -1)
+      if ((f = find_fault (fd, F_SHORT, size)))
         {
-          if (0 > output_offset)
-            {
-              output_offset = lseek (fd, 0, SEEK_CUR);
-              output_offset -= clen + pending;
-            }
-          if (0 <= output_offset)
-            {
-#if HAVE_POSIX_FADVISE
-              adv_ret = posix_fadvise (fd, output_offset, clen,
-                                       POSIX_FADV_DONTNEED);
-#else
-              errno = ENOTSUP;
-#endif
-              output_offset += clen + pending;
-            }
+          f->done = true;
+          if (fault_offset[fd] < f->offset)
+            size = f->offset - fault_offset[fd];
         }
     }
 
-  return adv_ret != -1 ? true : false;
+  ssize_t nread = sys_read (fd, buf, size);
+  if (0 < nread && fd <= STDOUT_FILENO)
+    fault_offset[fd] += nread;
+  return nread;
 }
 
-/* Read from FD into the buffer BUF of size SIZE, processing any
-   signals that arrive before bytes are read.  Return the number of
-   bytes read if successful, -1 (setting errno) on failure.  */
-
 static ssize_t
-iread (int fd, char *buf, size_t size)
+fault_write (int fd, void const *buf, size_t size)
 {
-  ssize_t nread;
+  struct fault *f;
 
-  do
+  if (fd == STDOUT_FILENO && (f = find_fault (fd, F_ENOSPC, size)))
     {
-      process_signals ();
-      nread = read (fd, buf, size);
-    }
-  while (nread < 0 && errno == EINTR);
-
-  /* Short read may be due to received signal.  */
-  if (0 < nread && nread < size)
-    process_signals ();
-
-  if (0 < nread && warn_partial_read)
-    {
-      static ssize_t prev_nread;
-
-      if (0 < prev_nread && prev_nread < size)
+      if (f->offset == fault_offset[fd])
         {
-          uintmax_t prev = prev_nread;
-          if (status_level != STATUS_NONE)
-            error (0, 0, ngettext (("warning: partial read (%"PRIuMAX" byte); "
-                                    "suggest iflag=fullblock"),
-                                   ("warning: partial read (%"PRIuMAX" bytes); "
-                                    "suggest iflag=fullblock"),
-                                   select_plural (prev)),
-                   prev);
-          warn_partial_read = false;
+          f->done = true;
+          errno = ENOSPC;
+          return -1;
         }
-
-      prev_nread = nread;
+      size = f->offset - fault_offset[fd];
     }
 
-  return nread;
+  ssize_t nwritten = sys_write (fd, buf, size);
+  if (0 < nwritten && fd <= STDOUT_FILENO)
+    fault_offset[fd] += nwritten;
+  return nwritten;
 }
 
-/* Wrapper around iread function to accumulate full blocks.  */
-static ssize_t
-iread_fullblock (int fd, char *buf, size_t size)
+static off_t
+fault_lseek (int fd, off_t offset, int whence)
 {
-  ssize_t nread = 0;
-
-  while (0 < size)
+  if (fd == STDIN_FILENO && ! (offset == 0 && whence == SEEK_CUR))
     {
-      ssize_t ncurr = iread (fd, buf, size);
-      if (ncurr < 0)
-        return ncurr;
-      if (ncurr == 0)
-        break;
-      nread += ncurr;
-      buf   += ncurr;
-      size  -= ncurr;
+      size_t i;
+      for (i = 0; i < n_faults; i++)
+        if (faults[i].kind == F_LSEEK)
+          {
+            /* Like skip_via_lseek when it detects the kernel bug.  */
+            errno = 0;
+            return -1;
+          }
     }
 
-  return nread;
+  off_t new_offset = lseek (fd, offset, whence);
+  if (0 <= new_offset && fd <= STDOUT_FILENO)
+    fault_offset[fd] = new_offset;
+  return new_offset;
 }
 
-/* Write to FD the buffer BUF of size SIZE, processing any signals
-   that arrive.  Return the number of bytes written, setting errno if
-   this is less than SIZE.  Keep trying if there are partial
-   writes.  */
+static struct io_backend const fault_io =
+{
+  .read = fault_read,
+  .write = fault_write,
+  .lseek = fault_lseek,
+  .ftruncate = ftruncate,
+  .fstat = fstat,
+  .fdatasync = fdatasync,
+  .fsync = fsync,
+  .fadvise = posix_fadvise,
+  .fallocate = fallocate,
+  .finish = finish_nothing
+};
+#endif
 
-static size_t
-iwrite (int fd, char const *buf, size_t size)
+#if HAVE_ZSTD
+/* The zstd seekable format is a series of independent frames followed
+   by a skippable frame holding the seek table: the compressed and
+   decompressed size of each frame, then a footer with the number of
+   frames, a descriptor byte and SEEKABLE_MAGIC.  All numbers are
+   32-bit little-endian.  */
+# define SKIPPABLE_MAGIC 0x184D2A5E
+# define SEEKABLE_MAGIC 0x8F92EAB1
+# define SKIPPABLE_HEADER_SIZE 8
+# define SEEK_TABLE_FOOTER_SIZE 9
+
+/* The descriptor bit saying that each entry has a checksum too.  */
+# define SEEK_TABLE_CHECKSUM 0x80
+
+/* With oflag=zstd-seekable, end a frame after this many bytes of input.
+   skip= decompresses at most this much that it does not need.  */
+# define SEEKABLE_FRAME_SIZE (4 * 1024 * 1024)
+
+static uint32_t
+get_le32 (unsigned char const *p)
 {
-  size_t total_written = 0;
+  return p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
 
-  if ((output_flags & O_DIRECT) && size < output_blocksize)
-    {
-      int old_flags = fcntl (STDOUT_FILENO, F_GETFL);
-      if (fcntl (STDOUT_FILENO, F_SETFL, old_flags & ~O_DIRECT) != 0
-          && status_level != STATUS_NONE)
-        error (0, errno, _("failed to turn off O_DIRECT: %s"),
-               quotef (output_file));
+static void
+put_le32 (unsigned char *p, uint32_t n)
+{
+  p[0] = n;
+  p[1] = n >> 8;
+  p[2] = n >> 16;
+  p[3] = n >> 24;
+}
+#endif
 
-      /* Since we have just turned off O_DIRECT for the final write,
-         here we try to preserve some of its semantics.  First, use
-         posix_fadvise to tell the system not to pollute the buffer
-         cache with this data.  Don't bother to diagnose lseek or
-         posix_fadvise failure. */
-      invalidate_cache (STDOUT_FILENO, 0);
+#if HAVE_ZSTD || HAVE_LZ4
+/* The backend that the compressed output goes to.  */
+static struct io_backend const *compressed_backend;
 
-      /* Attempt to ensure that that final block is committed
-         to disk as quickly as possible.  */
-      conversions_mask |= C_FSYNC;
-    }
+/* Buffer for compressed output.  */
+static char *zbuf;
+static size_t zbuf_size;
 
-  while (total_written < size)
-    {
-      ssize_t nwritten = 0;
-      process_signals ();
+# if HAVE_ZSTD
+static ZSTD_CCtx *zstd_cctx;
 
-      /* Perform a seek for a NUL block if sparse output is enabled.  */
-      final_op_was_seek = false;
-      if ((conversions_mask & C_SPARSE) && is_nul (buf, size))
-        {
-          if (lseek (fd, size, SEEK_CUR) < 0)
-            {
-              conversions_mask &= ~C_SPARSE;
-              /* Don't warn about the advisory sparse request.  */
-            }
-          else
-            {
-              final_op_was_seek = true;
-              nwritten = size;
-            }
-        }
+/* The seek table of oflag=zstd-seekable so far.  */
+static struct seek_entry
+{
+  uint32_t compressed;
+  uint32_t decompressed;
+} *seek_table;
+static size_t seek_table_len;
+static size_t seek_table_alloc;
+
+/* The number of bytes of input in the current frame, and of output
+   written for it so far.  */
+static size_t frame_in;
+static size_t frame_out;
+# endif
+# if HAVE_LZ4
+static LZ4F_cctx *lz4_cctx;
+static LZ4F_preferences_t const lz4_prefs =
+  {
+    .frameInfo = { .blockSizeID = LZ4F_max4MB }
+  };
 
-      if (!nwritten)
-        nwritten = write (fd, buf + total_written, size - total_written);
+/* Compress at most this many bytes per LZ4F_compressUpdate call,
+   so that ZBUF can stay a fixed size.  */
+#  define LZ4_CHUNK (4 * 1024 * 1024)
+# endif
 
-      if (nwritten < 0)
+/* Write all SIZE bytes of compressed data from BUF.  Return true if
+   successful, false with errno set otherwise.  */
+
+static bool
+write_compressed (char const *buf, size_t size)
+{
+  while (size)
+    {
+      ssize_t n = compressed_backend->write (STDOUT_FILENO, buf, size);
+      if (n < 0)
         {
-          if (errno != EINTR)
-            break;
+          if (errno == EINTR)
+            continue;
+          return false;
         }
-      else if (nwritten == 0)
+      if (n == 0)
         {
-          /* Some buggy drivers return 0 when one tries to write beyond
-             a device's end.  (Example: Linux kernel 1.2.13 on /dev/fd0.)
-             Set errno to ENOSPC so they get a sensible diagnostic.  */
           errno = ENOSPC;
-          break;
+          return false;
         }
-      else
-        total_written += nwritten;
+      buf += n;
+      size -= n;
     }
-
-  if (o_nocache && total_written)
-    invalidate_cache (fd, total_written);
-
-  return total_written;
+  return true;
 }
 
-/* Write, then empty, the output buffer 'obuf'. */
+# if HAVE_ZSTD
+/* Compress all of IN and write what comes out, adding its size to
+   frame_out.  If END is ZSTD_e_end, also flush the workers and write
+   the end of the frame.  Return true if successful, false with errno
+   set otherwise.  */
 
-static void
-write_output (void)
+static bool
+zstd_compress (ZSTD_inBuffer *in, ZSTD_EndDirective end)
 {
-  size_t nwritten = iwrite (STDOUT_FILENO, obuf, output_blocksize);
-  w_bytes += nwritten;
-  if (nwritten != output_blocksize)
+  size_t remaining;
+
+  do
     {
-      error (0, errno, _("writing to %s"), quoteaf (output_file));
-      if (nwritten != 0)
-        w_partial++;
-      quit (EXIT_FAILURE);
+      ZSTD_outBuffer out = { zbuf, zbuf_size, 0 };
+      remaining = ZSTD_compressStream2 (zstd_cctx, &out, in, end);
+      if (ZSTD_isError (remaining))
+        {
+          errno = EIO;
+          return false;
+        }
+      if (! write_compressed (zbuf, out.pos))
+        return false;
+      frame_out += out.pos;
     }
-  else
-    w_full++;
-  oc = 0;
+  while (end == ZSTD_e_end ? remaining : in->pos < in->size);
+
+  return true;
 }
 
-/* Restart on EINTR from fd_reopen().  */
+/* Compress SIZE bytes of BUF and write what comes out.  zstd hands
+   the input to its worker threads and returns frames in order.  */
 
-static int
-ifd_reopen (int desired_fd, char const *file, int flag, mode_t mode)
+static ssize_t
+zstd_write (int fd _GL_UNUSED, void const *buf, size_t size)
 {
-  int ret;
+  ZSTD_inBuffer in = { buf, size, 0 };
+  return zstd_compress (&in, ZSTD_e_continue) ? (ssize_t) size : -1;
+}
 
-  do
-    {
-      process_signals ();
-      ret = fd_reopen (desired_fd, file, flag, mode);
-    }
-  while (ret < 0 && errno == EINTR);
+/* Flush the workers and write the end of the zstd frame.  */
 
-  return ret;
+static int
+zstd_finish (int fd _GL_UNUSED)
+{
+  ZSTD_inBuffer in = { NULL, 0, 0 };
+  return zstd_compress (&in, ZSTD_e_end) ? 0 : -1;
 }
 
-/* Restart on EINTR from ftruncate().  */
+/* End the current seekable frame and add it to the seek table.  */
 
-static int
-iftruncate (int fd, off_t length)
+static bool
+end_seekable_frame (void)
 {
-  int ret;
+  ZSTD_inBuffer in = { NULL, 0, 0 };
 
-  do
+  if (! zstd_compress (&in, ZSTD_e_end))
+    return false;
+  if (seek_table_len == UINT32_MAX)
     {
-      process_signals ();
-      ret = ftruncate (fd, length);
+      errno = EFBIG;
+      return false;
     }
-  while (ret < 0 && errno == EINTR);
-
-  return ret;
+  if (seek_table_len == seek_table_alloc)
+    seek_table = X2NREALLOC (seek_table, &seek_table_alloc);
+  seek_table[seek_table_len].compressed = frame_out;
+  seek_table[seek_table_len].decompressed = frame_in;
+  seek_table_len++;
+  frame_in = frame_out = 0;
+  return true;
 }
 
-/* Return true if STR is of the form "PATTERN" or "PATTERNDELIM...".  */
+/* Compress SIZE bytes of BUF into frames of SEEKABLE_FRAME_SIZE input
+   bytes each, and write what comes out.  */
 
-static bool _GL_ATTRIBUTE_PURE
-operand_matches (char const *str, char const *pattern, char delim)
+static ssize_t
+zstd_seekable_write (int fd _GL_UNUSED, void const *buf, size_t size)
 {
-  while (*pattern)
-    if (*str++ != *pattern++)
-      return false;
-  return !*str || *str == delim;
+  char const *p = buf;
+  size_t left = size;
+
+  while (left)
+    {
+      size_t n = MIN (left, SEEKABLE_FRAME_SIZE - frame_in);
+      ZSTD_inBuffer in = { p, n, 0 };
+
+      if (! zstd_compress (&in, ZSTD_e_continue))
+        return -1;
+      frame_in += n;
+      p += n;
+      left -= n;
+
+      if (frame_in == SEEKABLE_FRAME_SIZE && ! end_seekable_frame ())
+        return -1;
+    }
+
+  return size;
 }
 
-/* Interpret one "conv=..." or similar operand STR according to the
-   symbols in TABLE, returning the flags specified.  If the operand
-   cannot be parsed, use ERROR_MSGID to generate a diagnostic.  */
+/* End the last frame, and write the seek table after it.  */
 
 static int
-parse_symbols (char const *str, struct symbol_value const *table,
-               bool exclusive, char const *error_msgid)
+zstd_seekable_finish (int fd _GL_UNUSED)
 {
-  int value = 0;
-
-  while (true)
+  size_t table_size;
+  unsigned char *table;
+  unsigned char *p;
+  size_t i;
+  bool ok;
+
+  /* Always write a frame, so that empty output still starts with the
+     zstd magic number.  */
+  if ((frame_in || ! seek_table_len) && ! end_seekable_frame ())
+    return -1;
+
+  table_size = (SKIPPABLE_HEADER_SIZE + seek_table_len * 8
+                + SEEK_TABLE_FOOTER_SIZE);
+  p = table = xmalloc (table_size);
+  put_le32 (p, SKIPPABLE_MAGIC);
+  put_le32 (p + 4, table_size - SKIPPABLE_HEADER_SIZE);
+  p += SKIPPABLE_HEADER_SIZE;
+  for (i = 0; i < seek_table_len; i++)
     {
-      char const *strcomma = strchr (str, ',');
-      struct symbol_value const *entry;
-
-      for (entry = table;
-           ! (operand_matches (str, entry->symbol, ',') && entry->value);
-           entry++)
-        {
-          if (! entry->symbol[0])
-            {
-              size_t slen = strcomma ? strcomma - str : strlen (str);
-              error (0, 0, "%s: %s", _(error_msgid),
-                     quotearg_n_style_mem (0, locale_quoting_style, str, slen));
-              usage (EXIT_FAILURE);
-            }
-        }
-
-      if (exclusive)
-        value = entry->value;
-      else
-        value |= entry->value;
-      if (!strcomma)
-        break;
-      str = strcomma + 1;
+      put_le32 (p, seek_table[i].compressed);
+      put_le32 (p + 4, seek_table[i].decompressed);
+      p += 8;
     }
+  put_le32 (p, seek_table_len);
+  p[4] = 0;
+  put_le32 (p + 5, SEEKABLE_MAGIC);
 
-  return value;
+  ok = write_compressed ((char const *) table, table_size);
+  free (table);
+  return ok ? 0 : -1;
 }
+# endif
 
-/* Return the value of STR, interpreted as a non-negative decimal integer,
-   optionally multiplied by various values.
-   Set *INVALID to a nonzero error value if STR does not represent a
-   number in this format.  */
+# if HAVE_LZ4
+/* Compress SIZE bytes of BUF into lz4 blocks and write them.  */
 
-static uintmax_t
-parse_integer (const char *str, strtol_error *invalid)
+static ssize_t
+lz4_write (int fd _GL_UNUSED, void const *buf, size_t size)
 {
-  uintmax_t n;
-  char *suffix;
-  strtol_error e = xstrtoumax (str, &suffix, 10, &n, "bcEGkKMPTwYZ0");
+  char const *p = buf;
+  size_t left = size;
 
-  if (e == LONGINT_INVALID_SUFFIX_CHAR && *suffix == 'x')
+  while (left)
     {
-      uintmax_t multiplier = parse_integer (suffix + 1, invalid);
-
-      if (multiplier != 0 && n * multiplier / multiplier != n)
+      size_t chunk = MIN (left, LZ4_CHUNK);
+      size_t n = LZ4F_compressUpdate (lz4_cctx, zbuf, zbuf_size,
+                                      p, chunk, NULL);
+      if (LZ4F_isError (n))
         {
-          *invalid = LONGINT_OVERFLOW;
-          return 0;
+          errno = EIO;
+          return -1;
         }
-
-      n *= multiplier;
-    }
-  else if (e != LONGINT_OK)
-    {
-      *invalid = e;
-      return 0;
+      if (! write_compressed (zbuf, n))
+        return -1;
+      p += chunk;
+      left -= chunk;
     }
 
-  return n;
+  return size;
 }
 
-/* OPERAND is of the form "X=...".  Return true if X is NAME.  */
+/* Write out the last lz4 block and the end mark of the frame.  */
 
-static bool _GL_ATTRIBUTE_PURE
-operand_is (char const *operand, char const *name)
+static int
+lz4_finish (int fd _GL_UNUSED)
 {
-  return operand_matches (operand, name, '=');
+  size_t n = LZ4F_compressEnd (lz4_cctx, zbuf, zbuf_size, NULL);
+  if (LZ4F_isError (n))
+    {
+      errno = EIO;
+      return -1;
+    }
+  return write_compressed (zbuf, n) ? 0 : -1;
 }
+# endif
 
-static void
-scanargs (int argc, char *const *argv)
+/* A compressed stream cannot be read back, seeked or truncated, and
+   reserving space for it is pointless as its size is unknown.  */
+
+static ssize_t
+compressed_read (int fd _GL_UNUSED, void *buf _GL_UNUSED,
+                 size_t size _GL_UNUSED)
 {
-  int i;
-  size_t blocksize = 0;
-  uintmax_t count = (uintmax_t) -1;
-  uintmax_t skip = 0;
-  uintmax_t seek = 0;
+  errno = EBADF;
+  return -1;
+}
 
-  for (i = optind; i < argc; i++)
-    {
-      char const *name = argv[i];
-      char const *val = strchr (name, '=');
-
-      if (val == NULL)
-        {
-          error (0, 0, _("unrecognized operand %s"),
-                 quote (name));
-          usage (EXIT_FAILURE);
-        }
-      val++;
+static off_t
+compressed_lseek (int fd _GL_UNUSED, off_t offset _GL_UNUSED,
+                  int whence _GL_UNUSED)
+{
+  errno = ESPIPE;
+  return -1;
+}
 
-      if (operand_is (name, "if"))
-        input_file = val;
-      else if (operand_is (name, "of"))
-        output_file = val;
-      else if (operand_is (name, "conv"))
-        conversions_mask |= parse_symbols (val, conversions, false,
-                                           N_("invalid conversion"));
-      else if (operand_is (name, "iflag"))
-        input_flags |= parse_symbols (val, flags, false,
-                                      N_("invalid input flag"));
-      else if (operand_is (name, "oflag"))
-        output_flags |= parse_symbols (val, flags, false,
-                                       N_("invalid output flag"));
-      else if (operand_is (name, "status"))
-        status_level = parse_symbols (val, statuses, true,
-                                      N_("invalid status level"));
-      else
-        {
-          strtol_error invalid = LONGINT_OK;
-          uintmax_t n = parse_integer (val, &invalid);
-          uintmax_t n_min = 0;
-          uintmax_t n_max = UINTMAX_MAX;
+static int
+compressed_ftruncate (int fd _GL_UNUSED, off_t length _GL_UNUSED)
+{
+  errno = EINVAL;
+  return -1;
+}
 
-          if (operand_is (name, "ibs"))
-            {
-              n_min = 1;
-              n_max = MAX_BLOCKSIZE (INPUT_BLOCK_SLOP);
-              input_blocksize = n;
-            }
-          else if (operand_is (name, "obs"))
-            {
-              n_min = 1;
-              n_max = MAX_BLOCKSIZE (OUTPUT_BLOCK_SLOP);
-              output_blocksize = n;
-            }
-          else if (operand_is (name, "bs"))
-            {
-              n_min = 1;
-              n_max = MAX_BLOCKSIZE (INPUT_BLOCK_SLOP);
-              blocksize = n;
-            }
-          else if (operand_is (name, "cbs"))
-            {
-              n_min = 1;
-              n_max = SIZE_MAX;
-              conversion_blocksize = n;
-            }
-          else if (operand_is (name, "skip"))
-            skip = n;
-          else if (operand_is (name, "seek"))
-            seek = n;
-          else if (operand_is (name, "count"))
-            count = n;
-          else
-            {
-              error (0, 0, _("unrecognized operand %s"),
-                     quote (name));
-              usage (EXIT_FAILURE);
-            }
+static int
+compressed_fallocate (int fd _GL_UNUSED, int mode _GL_UNUSED,
+                      off_t offset _GL_UNUSED, off_t len _GL_UNUSED)
+{
+  errno = EOPNOTSUPP;
+  return -1;
+}
 
-          if (n < n_min)
-            invalid = LONGINT_INVALID;
-          else if (n_max < n)
-            invalid = LONGINT_OVERFLOW;
+/* The rest goes to the file itself.  */
 
-          if (invalid != LONGINT_OK)
-            error (EXIT_FAILURE, invalid == LONGINT_OVERFLOW ? EOVERFLOW : 0,
-                   "%s: %s", _("invalid number"), quote (val));
-        }
-    }
+static int
+compressed_fstat (int fd, struct stat *st)
+{
+  return compressed_backend->fstat (fd, st);
+}
 
-  if (blocksize)
-    input_blocksize = output_blocksize = blocksize;
-  else
-    {
-      /* POSIX says dd aggregates partial reads into
-         output_blocksize if bs= is not specified.  */
-      conversions_mask |= C_TWOBUFS;
-    }
+static int
+compressed_fdatasync (int fd)
+{
+  return compressed_backend->fdatasync (fd);
+}
 
-  if (input_blocksize == 0)
-    input_blocksize = DEFAULT_BLOCKSIZE;
-  if (output_blocksize == 0)
-    output_blocksize = DEFAULT_BLOCKSIZE;
-  if (conversion_blocksize == 0)
-    conversions_mask &= ~(C_BLOCK | C_UNBLOCK);
+static int
+compressed_fsync (int fd)
+{
+  return compressed_backend->fsync (fd);
+}
 
-  if (input_flags & (O_DSYNC | O_SYNC))
-    input_flags |= O_RSYNC;
+static int
+compressed_fadvise (int fd, off_t offset, off_t len, int advice)
+{
+  return compressed_backend->fadvise (fd, offset, len, advice);
+}
 
-  if (output_flags & O_FULLBLOCK)
-    {
-      error (0, 0, "%s: %s", _("invalid output flag"), quote ("fullblock"));
-      usage (EXIT_FAILURE);
-    }
+# if HAVE_ZSTD
+static struct io_backend const zstd_io =
+{
+  .read = compressed_read,
+  .write = zstd_write,
+  .lseek = compressed_lseek,
+  .ftruncate = compressed_ftruncate,
+  .fstat = compressed_fstat,
+  .fdatasync = compressed_fdatasync,
+  .fsync = compressed_fsync,
+  .fadvise = compressed_fadvise,
+  .fallocate = compressed_fallocate,
+  .finish = zstd_finish
+};
 
-  if (input_flags & O_SEEK_BYTES)
-    {
-      error (0, 0, "%s: %s", _("invalid input flag"), quote ("seek_bytes"));
-      usage (EXIT_FAILURE);
-    }
+static struct io_backend const zstd_seekable_io =
+{
+  .read = compressed_read,
+  .write = zstd_seekable_write,
+  .lseek = compressed_lseek,
+  .ftruncate = compressed_ftruncate,
+  .fstat = compressed_fstat,
+  .fdatasync = compressed_fdatasync,
+  .fsync = compressed_fsync,
+  .fadvise = compressed_fadvise,
+  .fallocate = compressed_fallocate,
+  .finish = zstd_seekable_finish
+};
+# endif
 
-  if (output_flags & (O_COUNT_BYTES | O_SKIP_BYTES))
-    {
-      error (0, 0, "%s: %s", _("invalid output flag"),
-             quote (output_flags & O_COUNT_BYTES
-                    ? "count_bytes" : "skip_bytes"));
-      usage (EXIT_FAILURE);
-    }
+# if HAVE_LZ4
+static struct io_backend const lz4_io =
+{
+  .read = compressed_read,
+  .write = lz4_write,
+  .lseek = compressed_lseek,
+  .ftruncate = compressed_ftruncate,
+  .fstat = compressed_fstat,
+  .fdatasync = compressed_fdatasync,
+  .fsync = compressed_fsync,
+  .fadvise = compressed_fadvise,
+  .fallocate = compressed_fallocate,
+  .finish = lz4_finish
+};
+# endif
+#endif
 
-  if (input_flags & O_SKIP_BYTES && skip != 0)
-    {
-      skip_records = skip / input_blocksize;
-      skip_bytes = skip % input_blocksize;
-    }
-  else if (skip != 0)
-    skip_records = skip;
+/* Return a backend that compresses the output as output_compression
+   says, and writes it through BACKEND.  */
 
-  if (input_flags & O_COUNT_BYTES && count != (uintmax_t) -1)
+static struct io_backend const *
+compress_backend (struct io_backend const *backend)
+{
+#if HAVE_ZSTD
+  if (output_compression == COMPRESS_ZSTD
+      || output_compression == COMPRESS_ZSTD_SEEKABLE)
     {
-      max_records = count / input_blocksize;
-      max_bytes = count % input_blocksize;
+      bool seekable = output_compression == COMPRESS_ZSTD_SEEKABLE;
+      zstd_cctx = ZSTD_createCCtx ();
+      if (! zstd_cctx)
+        xalloc_die ();
+      if (zstd_level)
+        ZSTD_CCtx_setParameter (zstd_cctx, ZSTD_c_compressionLevel,
+                                zstd_level);
+      /* This fails harmlessly if libzstd was built without threads.  */
+      ZSTD_CCtx_setParameter (zstd_cctx, ZSTD_c_nbWorkers,
+                              num_processors (NPROC_CURRENT_OVERRIDABLE));
+      /* Split each seekable frame into jobs, or it would occupy just
+         one worker.  */
+      if (seekable)
+        ZSTD_CCtx_setParameter (zstd_cctx, ZSTD_c_jobSize,
+                                SEEKABLE_FRAME_SIZE / 4);
+      zbuf_size = ZSTD_CStreamOutSize ();
+      zbuf = xmalloc (zbuf_size);
+      compressed_backend = backend;
+      return seekable ? &zstd_seekable_io : &zstd_io;
     }
-  else if (count != (uintmax_t) -1)
-    max_records = count;
-
-  if (output_flags & O_SEEK_BYTES && seek != 0)
+#endif
+#if HAVE_LZ4
+  if (output_compression == COMPRESS_LZ4)
     {
-      seek_records = seek / output_blocksize;
-      seek_bytes = seek % output_blocksize;
+      if (LZ4F_isError (LZ4F_createCompressionContext (&lz4_cctx,
+                                                       LZ4F_VERSION)))
+        xalloc_die ();
+      zbuf_size = MAX (LZ4F_compressBound (LZ4_CHUNK, &lz4_prefs),
+                       LZ4F_HEADER_SIZE_MAX);
+      zbuf = xmalloc (zbuf_size);
+      compressed_backend = backend;
+
+      size_t n = LZ4F_compressBegin (lz4_cctx, zbuf, zbuf_size, &lz4_prefs);
+      if (LZ4F_isError (n) || ! write_compressed (zbuf, n))
+        error (EXIT_FAILURE, errno, _("error writing %s"),
+               quoteaf (output_file));
+      return &lz4_io;
     }
-  else if (seek != 0)
-    seek_records = seek;
+#endif
+  return backend;
+}
 
-  /* Warn about partial reads if bs=SIZE is given and iflag=fullblock
-     is not, and if counting or skipping bytes or using direct I/O.
-     This helps to avoid confusion with miscounts, and to avoid issues
-     with direct I/O on GNU/Linux.  */
-  warn_partial_read =
-    (! (conversions_mask & C_TWOBUFS) && ! (input_flags & O_FULLBLOCK)
-     && (skip_records
-         || (0 < max_records && max_records < (uintmax_t) -1)
-         || (input_flags | output_flags) & O_DIRECT));
+/* With oflag=tee and several of= operands, the output is fanned out:
+   whatever is written to the first output file, open on STDOUT_FILENO,
+   is written to each of the others too.  seek= and conv=sparse are
+   rejected with several outputs, so the output is never repositioned,
+   and lseek is used only to find the offset of the first.  */
 
-  iread_fnc = ((input_flags & O_FULLBLOCK)
-               ? iread_fullblock
-               : iread);
-  input_flags &= ~O_FULLBLOCK;
+/* The backend of the first output file.  */
+static struct io_backend const *fanned_backend;
 
-  if (multiple_bits_set (conversions_mask & (C_ASCII | C_EBCDIC | C_IBM)))
-    error (EXIT_FAILURE, 0, _("cannot combine any two of {ascii,ebcdic,ibm}"));
-  if (multiple_bits_set (conversions_mask & (C_BLOCK | C_UNBLOCK)))
-    error (EXIT_FAILURE, 0, _("cannot combine block and unblock"));
-  if (multiple_bits_set (conversions_mask & (C_LCASE | C_UCASE)))
-    error (EXIT_FAILURE, 0, _("cannot combine lcase and ucase"));
-  if (multiple_bits_set (conversions_mask & (C_EXCL | C_NOCREAT)))
-    error (EXIT_FAILURE, 0, _("cannot combine excl and nocreat"));
-  if (multiple_bits_set (input_flags & (O_DIRECT | O_NOCACHE))
-      || multiple_bits_set (output_flags & (O_DIRECT | O_NOCACHE)))
-    error (EXIT_FAILURE, 0, _("cannot combine direct and nocache"));
+/* Write all SIZE bytes of BUF to the extra output I.  Diagnose a
+   failure and return false.  */
 
-  if (input_flags & O_NOCACHE)
-    {
-      i_nocache = true;
-      input_flags &= ~O_NOCACHE;
-    }
-  if (output_flags & O_NOCACHE)
+static bool
+write_extra_output (size_t i, char const *buf, size_t size)
+{
+  while (size != 0)
     {
-      o_nocache = true;
-      output_flags &= ~O_NOCACHE;
+      process_signals ();
+      ssize_t n = sys_write (extra_output_fds[i], buf, size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          if (n == 0)
+            errno = ENOSPC;
+          error (0, errno, _("error writing %s"),
+                 quoteaf (extra_output_files[i]));
+          return false;
+        }
+      buf += n;
+      size -= n;
     }
+  return true;
 }
 
-/* Fix up translation table. */
-
-static void
-apply_translations (void)
+static ssize_t
+fanout_write (int fd, void const *buf, size_t size)
 {
-  int i;
+  ssize_t n = fanned_backend->write (fd, buf, size);
+  size_t i;
 
-  if (conversions_mask & C_ASCII)
-    translate_charset (ebcdic_to_ascii);
+  if (0 < n)
+    for (i = 0; i < n_extra_outputs; i++)
+      if (! write_extra_output (i, buf, n))
+        quit (EXIT_FAILURE);
+  return n;
+}
 
-  if (conversions_mask & C_UCASE)
-    {
-      for (i = 0; i < 256; i++)
-        trans_table[i] = toupper (trans_table[i]);
-      translation_needed = true;
-    }
-  else if (conversions_mask & C_LCASE)
-    {
-      for (i = 0; i < 256; i++)
-        trans_table[i] = tolower (trans_table[i]);
-      translation_needed = true;
-    }
+static ssize_t
+fanout_read (int fd, void *buf, size_t size)
+{
+  return fanned_backend->read (fd, buf, size);
+}
 
-  if (conversions_mask & C_EBCDIC)
-    {
-      translate_charset (ascii_to_ebcdic);
-      newline_character = ascii_to_ebcdic['\n'];
-      space_character = ascii_to_ebcdic[' '];
-    }
-  else if (conversions_mask & C_IBM)
-    {
-      translate_charset (ascii_to_ibm);
-      newline_character = ascii_to_ibm['\n'];
-      space_character = ascii_to_ibm[' '];
-    }
+static off_t
+fanout_lseek (int fd, off_t offset, int whence)
+{
+  return fanned_backend->lseek (fd, offset, whence);
 }
 
-/* Apply the character-set translations specified by the user
-   to the NREAD bytes in BUF.  */
+static int
+fanout_fstat (int fd, struct stat *st)
+{
+  return fanned_backend->fstat (fd, st);
+}
 
-static void
-translate_buffer (char *buf, size_t nread)
+static int
+fanout_ftruncate (int fd, off_t length)
 {
-  char *cp;
+  int ret = fanned_backend->ftruncate (fd, length);
   size_t i;
 
-  for (i = nread, cp = buf; i; i--, cp++)
-    *cp = trans_table[to_uchar (*cp)];
+  for (i = 0; ret == 0 && i < n_extra_outputs; i++)
+    ret = ftruncate (extra_output_fds[i], length);
+  return ret;
 }
 
-/* If true, the last char from the previous call to 'swab_buffer'
-   is saved in 'saved_char'.  */
-static bool char_is_saved = false;
-
-/* Odd char from previous call.  */
-static char saved_char;
+static int
+fanout_fdatasync (int fd)
+{
+  int ret = fanned_backend->fdatasync (fd);
+  size_t i;
 
-/* Swap NREAD bytes in BUF, plus possibly an initial char from the
-   previous call.  If NREAD is odd, save the last char for the
-   next call.   Return the new start of the BUF buffer.  */
+  for (i = 0; ret == 0 && i < n_extra_outputs; i++)
+    ret = fdatasync (extra_output_fds[i]);
+  return ret;
+}
 
-static char *
-swab_buffer (char *buf, size_t *nread)
+static int
+fanout_fsync (int fd)
 {
-  char *bufstart = buf;
-  char *cp;
+  int ret = fanned_backend->fsync (fd);
   size_t i;
 
-  /* Is a char left from last time?  */
-  if (char_is_saved)
-    {
-      *--bufstart = saved_char;
-      (*nread)++;
-      char_is_saved = false;
-    }
+  for (i = 0; ret == 0 && i < n_extra_outputs; i++)
+    ret = fsync (extra_output_fds[i]);
+  return ret;
+}
 
-  if (*nread & 1)
-    {
-      /* An odd number of chars are in the buffer.  */
-      saved_char = bufstart[--*nread];
-      char_is_saved = true;
-    }
+/* Advice and preallocation are not essential, so apply them to every
+   output regardless of failures, and report only the first one's.  */
 
-  /* Do the byte-swapping by moving every second character two
-     positions toward the end, working from the end of the buffer
-     toward the beginning.  This way we only move half of the data.  */
+static int
+fanout_fadvise (int fd, off_t offset, off_t len, int advice)
+{
+  size_t i;
 
-  cp = bufstart + *nread;	/* Start one char past the last.  */
-  for (i = *nread / 2; i; i--, cp -= 2)
-    *cp = *(cp - 2);
+  for (i = 0; i < n_extra_outputs; i++)
+    posix_fadvise (extra_output_fds[i], offset, len, advice);
+  return fanned_backend->fadvise (fd, offset, len, advice);
+}
 
-  return ++bufstart;
+static int
+fanout_fallocate (int fd, int mode, off_t offset, off_t len)
+{
+  size_t i;
+
+  for (i = 0; i < n_extra_outputs; i++)
+    fallocate (extra_output_fds[i], mode, offset, len);
+  return fanned_backend->fallocate (fd, mode, offset, len);
 }
 
-/* Add OFFSET to the input offset, setting the overflow flag if
-   necessary.  */
+static int
+fanout_finish (int fd)
+{
+  return fanned_backend->finish (fd);
+}
 
-static void
-advance_input_offset (uintmax_t offset)
+static struct io_backend const fanout_io =
 {
-  input_offset += offset;
-  if (input_offset < offset)
-    input_offset_overflow = true;
+  .read = fanout_read,
+  .write = fanout_write,
+  .lseek = fanout_lseek,
+  .ftruncate = fanout_ftruncate,
+  .fstat = fanout_fstat,
+  .fdatasync = fanout_fdatasync,
+  .fsync = fanout_fsync,
+  .fadvise = fanout_fadvise,
+  .fallocate = fanout_fallocate,
+  .finish = fanout_finish
+};
+
+/* Return a backend that writes to BACKEND, for the first output file,
+   and to the extra output files as well.  */
+
+static struct io_backend const *
+fanout_backend (struct io_backend const *backend)
+{
+  if (! n_extra_outputs)
+    return backend;
+  fanned_backend = backend;
+  return &fanout_io;
 }
 
-/* This is a wrapper for lseek.  It detects and warns about a kernel
-   bug that makes lseek a no-op for tape devices, even though the kernel
-   lseek return value suggests that the function succeeded.
+#if HAVE_DECOMPRESSION
+/* Compressed input formats, for iflag=decompress.  */
+enum
+  {
+    FORMAT_NONE,
+    FORMAT_GZIP,
+    FORMAT_ZSTD,
+    FORMAT_XZ,
+    FORMAT_LZ4
+  };
 
-   The parameters are the same as those of the lseek function, but
-   with the addition of FILENAME, the name of the file associated with
-   descriptor FDESC.  The file name is used solely in the warning that's
-   printed when the bug is detected.  Return the same value that lseek
-   would have returned, but when the lseek bug is detected, return -1
-   to indicate that lseek failed.
+/* The leading bytes that identify each format.  */
+static struct
+{
+  unsigned char magic[6];
+  size_t len;
+  int format;
+  char const *name;
+} const input_formats[] =
+{
+  {{0x1f, 0x8b}, 2, FORMAT_GZIP, "gzip"},
+  {{0x28, 0xb5, 0x2f, 0xfd}, 4, FORMAT_ZSTD, "zstd"},
+  {{0xfd, '7', 'z', 'X', 'Z', 0x00}, 6, FORMAT_XZ, "xz"},
+  {{0x04, 0x22, 0x4d, 0x18}, 4, FORMAT_LZ4, "lz4"}
+};
 
-   The offending behavior has been confirmed with an Exabyte SCSI tape
-   drive accessed via /dev/nst0 on both Linux 2.2.17 and 2.4.16 kernels.  */
+/* The longest magic number.  */
+# define MAGIC_MAX 6
 
-#ifdef __linux__
+/* Read the compressed input this many bytes at a time.  */
+# define DECOMPRESS_IN_SIZE (128 * 1024)
 
-# include <sys/mtio.h>
+/* The helper thread hands decompressed data over in up to
+   DECOMPRESS_CHUNKS chunks of DECOMPRESS_CHUNK_SIZE bytes, so it can
+   run that far ahead of dd_copy.  */
+# define DECOMPRESS_CHUNKS 4
+# define DECOMPRESS_CHUNK_SIZE (1024 * 1024)
 
-# define MT_SAME_POSITION(P, Q) \
-   ((P).mt_resid == (Q).mt_resid \
-    && (P).mt_fileno == (Q).mt_fileno \
-    && (P).mt_blkno == (Q).mt_blkno)
+/* The backend that the compressed input comes from.  */
+static struct io_backend const *raw_input_backend;
 
-static off_t
-skip_via_lseek (char const *filename, int fdesc, off_t offset, int whence)
+/* The format of the input.  */
+static int input_format;
+
+/* Compressed input, of which ZIN_POS of ZIN_LEN bytes are decoded.  */
+static char *zin;
+static size_t zin_len;
+static size_t zin_pos;
+
+/* Whether the decoder is between two compressed streams, so that the
+   input may end there.  */
+static bool decode_at_boundary;
+
+/* The number of decompressed bytes to throw away before the first
+   that is read, because a seek landed inside a frame.  */
+static uintmax_t decompress_discard;
+
+/* Whether the helper thread has been started.  This is put off until
+   the first read, so that skip= can seek first.  */
+static bool decompress_started;
+
+# if HAVE_ZSTD
+/* The frames of seekable zstd input, from its seek table: where each
+   starts in the compressed input and in the decompressed data.  One
+   more entry marks where the frames end.  NULL if the input has no
+   usable seek table.  */
+static struct seekable_frame
 {
-  struct mtget s1;
-  struct mtget s2;
-  bool got_original_tape_position = (ioctl (fdesc, MTIOCGET, &s1) == 0);
-  /* known bad device type */
-  /* && s.mt_type == MT_ISSCSI2 */
+  off_t compressed;
+  off_t offset;
+} *seekable_frames;
+static size_t seekable_frame_count;
+
+/* The offset in the decompressed data that the next read starts at,
+   and the frame that holds it, until the helper thread is started.  */
+static off_t seekable_position;
+static size_t seekable_next_frame;
+
+/* Decode seekable frames in parallel only if none is bigger than this,
+   as each is decoded whole in memory.  */
+#  define PARALLEL_FRAME_MAX (64 * 1024 * 1024)
+
+/* With a seek table, the frames are independent and their sizes are
+   known, so a pool of threads decodes them in parallel, each frame
+   whole.  The helper thread reads the frames into a ring of jobs, and
+   hands the decoded frames over to the reader in order.  Jobs below
+   FRAME_JOBS_QUEUED have been read, those below FRAME_JOBS_TAKEN have
+   been claimed by a decoding thread, and those below
+   FRAME_JOBS_COLLECTED have been handed over.  */
+static struct frame_job
+{
+  char *in;
+  size_t in_len;
+  size_t in_size;
+  char *out;
+  size_t out_len;
+  size_t out_size;
+  bool done;
+  bool failed;
+} *frame_jobs;
+static size_t n_frame_jobs;
+static size_t frame_jobs_queued;
+static size_t frame_jobs_taken;
+static size_t frame_jobs_collected;
+
+/* Set when no more jobs will be queued.  */
+static bool frame_jobs_over;
+
+static pthread_mutex_t frame_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t frame_job_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t frame_job_done = PTHREAD_COND_INITIALIZER;
+# endif
 
-  off_t new_position = lseek (fdesc, offset, whence);
-  if (0 <= new_position
-      && got_original_tape_position
-      && ioctl (fdesc, MTIOCGET, &s2) == 0
-      && MT_SAME_POSITION (s1, s2))
+# if HAVE_ZLIB
+static z_stream gz_stream;
+
+/* Whether NUL padding has been seen after the last gzip member.  */
+static bool gz_padded;
+# endif
+# if HAVE_LZMA
+static lzma_stream xz_stream = LZMA_STREAM_INIT;
+# endif
+# if HAVE_ZSTD
+static ZSTD_DStream *zstd_dstream;
+# endif
+# if HAVE_LZ4
+static LZ4F_dctx *lz4_dctx;
+# endif
+
+/* A ring of decompressed chunks.  The helper thread fills the one
+   after the last full one, and the reader drains the first, so each
+   is touched by one thread at a time.  */
+static struct decompressed_chunk
+{
+  char *data;
+  size_t len;
+  size_t pos;
+  size_t size;
+} dchunks[DECOMPRESS_CHUNKS];
+static size_t dchunk_head;
+static size_t dchunk_count;
+
+/* Set by the helper thread when it has produced its last chunk, with
+   the errno value of the failure that stopped it, if any.  */
+static bool decompress_done;
+static int decompress_errno;
+
+static pthread_mutex_t dchunk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dchunk_filled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t dchunk_emptied = PTHREAD_COND_INITIALIZER;
+
+/* Decode compressed bytes from IN, of *IN_LEN bytes, into OUT, of
+   *OUT_LEN bytes, and set *IN_LEN and *OUT_LEN to the numbers of bytes
+   consumed and produced.  FINISH says that IN holds the last of the
+   input.  Return true if successful, false if the data is corrupt.  */
+
+static bool
+decode (char const *in, size_t *in_len, char *out, size_t *out_len,
+        bool finish _GL_UNUSED)
+{
+  switch (input_format)
     {
-      if (status_level != STATUS_NONE)
-        error (0, 0, _("warning: working around lseek kernel bug for file "
-                       "(%s)\n  of mt_type=0x%0lx -- "
-                       "see <sys/mtio.h> for the list of types"),
-               filename, s2.mt_type + 0Lu);
-      errno = 0;
-      new_position = -1;
+# if HAVE_ZLIB
+    case FORMAT_GZIP:
+      {
+        int r;
+
+        /* Like gzip, accept NULs after the last member, as tapes and
+           block devices pad it out, but nothing after them.  */
+        if (decode_at_boundary && (gz_padded || (*in_len && ! in[0])))
+          {
+            size_t n = 0;
+            while (n < *in_len && ! in[n])
+              n++;
+            if (n < *in_len)
+              return false;
+            *out_len = 0;
+            gz_padded = true;
+            return true;
+          }
+
+        gz_stream.next_in = (Bytef *) in;
+        gz_stream.avail_in = *in_len;
+        gz_stream.next_out = (Bytef *) out;
+        gz_stream.avail_out = *out_len;
+        r = inflate (&gz_stream, Z_NO_FLUSH);
+        *in_len -= gz_stream.avail_in;
+        *out_len -= gz_stream.avail_out;
+        if (r == Z_STREAM_END)
+          {
+            /* Another gzip member may follow.  */
+            decode_at_boundary = true;
+            return inflateReset (&gz_stream) == Z_OK;
+          }
+        if (*in_len || *out_len)
+          decode_at_boundary = false;
+        return r == Z_OK || r == Z_BUF_ERROR;
+      }
+# endif
+# if HAVE_LZMA
+    case FORMAT_XZ:
+      {
+        lzma_ret r;
+        xz_stream.next_in = (uint8_t const *) in;
+        xz_stream.avail_in = *in_len;
+        xz_stream.next_out = (uint8_t *) out;
+        xz_stream.avail_out = *out_len;
+        r = lzma_code (&xz_stream, finish ? LZMA_FINISH : LZMA_RUN);
+        *in_len -= xz_stream.avail_in;
+        *out_len -= xz_stream.avail_out;
+        /* With LZMA_CONCATENATED, the end is only known when told.  */
+        decode_at_boundary = r == LZMA_STREAM_END;
+        return r == LZMA_OK || r == LZMA_STREAM_END || r == LZMA_BUF_ERROR;
+      }
+# endif
+# if HAVE_ZSTD
+    case FORMAT_ZSTD:
+      {
+        ZSTD_inBuffer zsrc = { in, *in_len, 0 };
+        ZSTD_outBuffer zdst = { out, *out_len, 0 };
+        size_t r = ZSTD_decompressStream (zstd_dstream, &zdst, &zsrc);
+        *in_len = zsrc.pos;
+        *out_len = zdst.pos;
+        if (ZSTD_isError (r))
+          return false;
+        if (*in_len || *out_len)
+          decode_at_boundary = r == 0;
+        return true;
+      }
+# endif
+# if HAVE_LZ4
+    case FORMAT_LZ4:
+      {
+        size_t r = LZ4F_decompress (lz4_dctx, out, out_len, in, in_len, NULL);
+        if (LZ4F_isError (r))
+          return false;
+        if (*in_len || *out_len)
+          decode_at_boundary = r == 0;
+        return true;
+      }
+# endif
+    default:
+      /* Not compressed after all, so pass it through.  */
+      *in_len = *out_len = MIN (*in_len, *out_len);
+      memcpy (out, in, *out_len);
+      decode_at_boundary = true;
+      return true;
     }
+}
 
-  return new_position;
+/* Return the chunk after the last full one, once it is free.  */
+
+static struct decompressed_chunk *
+free_dchunk (void)
+{
+  struct decompressed_chunk *chunk;
+
+  pthread_mutex_lock (&dchunk_lock);
+  while (dchunk_count == DECOMPRESS_CHUNKS)
+    pthread_cond_wait (&dchunk_emptied, &dchunk_lock);
+  chunk = &dchunks[(dchunk_head + dchunk_count) % DECOMPRESS_CHUNKS];
+  pthread_mutex_unlock (&dchunk_lock);
+
+  chunk->len = chunk->pos = 0;
+  return chunk;
 }
-#else
-# define skip_via_lseek(Filename, Fd, Offset, Whence) lseek (Fd, Offset, Whence)
-#endif
 
-/* Throw away RECORDS blocks of BLOCKSIZE bytes plus BYTES bytes on
-   file descriptor FDESC, which is open with read permission for FILE.
-   Store up to BLOCKSIZE bytes of the data at a time in IBUF or OBUF, if
-   necessary. RECORDS or BYTES must be nonzero. If FDESC is
-   STDIN_FILENO, advance the input offset. Return the number of
-   records remaining, i.e., that were not skipped because EOF was
-   reached.  If FDESC is STDOUT_FILENO, on return, BYTES is the
-   remaining bytes in addition to the remaining records.  */
+/* Hand the chunk that free_dchunk returned over to the reader.  */
 
-static uintmax_t
-skip (int fdesc, char const *file, uintmax_t records, size_t blocksize,
-      size_t *bytes)
+static void
+publish_dchunk (void)
 {
-  uintmax_t offset = records * blocksize + *bytes;
+  pthread_mutex_lock (&dchunk_lock);
+  dchunk_count++;
+  pthread_cond_signal (&dchunk_filled);
+  pthread_mutex_unlock (&dchunk_lock);
+}
 
-  /* Try lseek and if an error indicates it was an inappropriate operation --
-     or if the file offset is not representable as an off_t --
-     fall back on using read.  */
+/* Hand CHUNK, the last that the helper thread filled, if any, over to
+   the reader, and tell it that there are no more, because of the
+   failure with errno value ERR if nonzero.  */
 
-  errno = 0;
-  if (records <= OFF_T_MAX / blocksize
-      && 0 <= skip_via_lseek (file, fdesc, offset, SEEK_CUR))
-    {
-      if (fdesc == STDIN_FILENO)
-        {
-           struct stat st;
-           if (fstat (STDIN_FILENO, &st) != 0)
-             error (EXIT_FAILURE, errno, _("cannot fstat %s"), quoteaf (file));
-           if (usable_st_size (&st) && st.st_size < input_offset + offset)
-             {
-               /* When skipping past EOF, return the number of _full_ blocks
-                * that are not skipped, and set offset to EOF, so the caller
-                * can determine the requested skip was not satisfied.  */
-               records = ( offset - st.st_size ) / blocksize;
-               offset = st.st_size - input_offset;
-             }
-           else
-             records = 0;
-           advance_input_offset (offset);
-        }
-      else
-        {
-          records = 0;
-          *bytes = 0;
-        }
-      return records;
-    }
-  else
+static void
+end_dchunks (struct decompressed_chunk *chunk, int err)
+{
+  pthread_mutex_lock (&dchunk_lock);
+  if (chunk && chunk->len)
+    dchunk_count++;
+  decompress_errno = err;
+  decompress_done = true;
+  pthread_cond_signal (&dchunk_filled);
+  pthread_mutex_unlock (&dchunk_lock);
+}
+
+/* The helper thread: read and decode the input until it ends.  */
+
+static void *
+decompress_input (void *arg _GL_UNUSED)
+{
+  struct decompressed_chunk *chunk = NULL;
+  bool eof = false;
+  int err = 0;
+
+  while (true)
     {
-      int lseek_errno = errno;
+      size_t in_len;
+      size_t out_len;
 
-      /* The seek request may have failed above if it was too big
-         (> device size, > max file size, etc.)
-         Or it may not have been done at all (> OFF_T_MAX).
-         Therefore try to seek to the end of the file,
-         to avoid redundant reading.  */
-      if ((skip_via_lseek (file, fdesc, 0, SEEK_END)) >= 0)
+      if (zin_pos == zin_len && ! eof)
         {
-          /* File is seekable, and we're at the end of it, and
-             size <= OFF_T_MAX. So there's no point using read to advance.  */
+          ssize_t n;
 
-          if (!lseek_errno)
+          /* Let the reader have what there is while waiting for more.  */
+          if (chunk && chunk->len)
             {
-              /* The original seek was not attempted as offset > OFF_T_MAX.
-                 We should error for write as can't get to the desired
-                 location, even if OFF_T_MAX < max file size.
-                 For read we're not going to read any data anyway,
-                 so we should error for consistency.
-                 It would be nice to not error for /dev/{zero,null}
-                 for any offset, but that's not a significant issue.  */
-              lseek_errno = EOVERFLOW;
+              publish_dchunk ();
+              chunk = NULL;
             }
 
-          if (fdesc == STDIN_FILENO)
-            error (0, lseek_errno, _("%s: cannot skip"), quotef (file));
-          else
-            error (0, lseek_errno, _("%s: cannot seek"), quotef (file));
-          /* If the file has a specific size and we've asked
-             to skip/seek beyond the max allowable, then quit.  */
-          quit (EXIT_FAILURE);
+          do
+            n = raw_input_backend->read (STDIN_FILENO, zin,
+                                         DECOMPRESS_IN_SIZE);
+          while (n < 0 && errno == EINTR);
+          if (n < 0)
+            {
+              err = errno;
+              break;
+            }
+          eof = n == 0;
+          zin_pos = 0;
+          zin_len = n;
         }
-      /* else file_size && offset > OFF_T_MAX or file ! seekable */
 
-      char *buf;
-      if (fdesc == STDIN_FILENO)
+      if (! chunk)
+        chunk = free_dchunk ();
+
+      in_len = zin_len - zin_pos;
+      out_len = DECOMPRESS_CHUNK_SIZE - chunk->len;
+      if (! decode (zin + zin_pos, &in_len, chunk->data + chunk->len,
+                    &out_len, eof))
         {
-          alloc_ibuf ();
-          buf = ibuf;
+          err = EBADMSG;
+          break;
         }
-      else
+      zin_pos += in_len;
+
+      if (decompress_discard)
         {
-          alloc_obuf ();
-          buf = obuf;
+          size_t n = MIN (decompress_discard, out_len);
+          memmove (chunk->data + chunk->len, chunk->data + chunk->len + n,
+                   out_len - n);
+          decompress_discard -= n;
+          chunk->len += out_len - n;
         }
+      else
+        chunk->len += out_len;
 
-      do
+      if (chunk->len == DECOMPRESS_CHUNK_SIZE)
         {
-          ssize_t nread = iread_fnc (fdesc, buf, records ? blocksize : *bytes);
-          if (nread < 0)
-            {
-              if (fdesc == STDIN_FILENO)
-                {
-                  error (0, errno, _("error reading %s"), quoteaf (file));
-                  if (conversions_mask & C_NOERROR)
-                    print_stats ();
-                }
-              else
-                error (0, lseek_errno, _("%s: cannot seek"), quotef (file));
-              quit (EXIT_FAILURE);
-            }
-          else if (nread == 0)
-            break;
-          else if (fdesc == STDIN_FILENO)
-            advance_input_offset (nread);
-
-          if (records != 0)
-            records--;
-          else
-            *bytes = 0;
+          publish_dchunk ();
+          chunk = NULL;
         }
-      while (records || *bytes);
+      else if (! in_len && ! out_len && (eof || zin_pos < zin_len))
+        {
+          /* The decoder is done, or is stuck on corrupt input.  */
+          if (zin_pos < zin_len || ! decode_at_boundary)
+            err = EBADMSG;
+          break;
+        }
+    }
 
-      return records;
+  end_dchunks (chunk, err);
+  return NULL;
+}
+
+# if HAVE_ZSTD
+/* Read exactly SIZE bytes of compressed input into BUF, starting with
+   any left over in ZIN.  Return 0 if successful, else an errno value.  */
+
+static int
+read_compressed (char *buf, size_t size)
+{
+  size_t n = MIN (size, zin_len - zin_pos);
+
+  memcpy (buf, zin + zin_pos, n);
+  zin_pos += n;
+  while (n < size)
+    {
+      ssize_t nread = raw_input_backend->read (STDIN_FILENO, buf + n,
+                                               size - n);
+      if (nread < 0 && errno == EINTR)
+        continue;
+      if (nread <= 0)
+        return nread < 0 ? errno : EBADMSG;
+      n += nread;
     }
+  return 0;
 }
 
-/* Advance the input by NBYTES if possible, after a read error.
-   The input file offset may or may not have advanced after the failed
-   read; adjust it to point just after the bad record regardless.
-   Return true if successful, or if the input is already known to not
-   be seekable.  */
+/* A thread of the pool that decodes seekable frames.  */
+
+static void *
+decode_frames (void *arg _GL_UNUSED)
+{
+  ZSTD_DCtx *dctx = ZSTD_createDCtx ();
+
+  pthread_mutex_lock (&frame_job_lock);
+  while (true)
+    {
+      struct frame_job *job;
+      size_t r;
+
+      while (frame_jobs_taken == frame_jobs_queued && ! frame_jobs_over)
+        pthread_cond_wait (&frame_job_queued, &frame_job_lock);
+      if (frame_jobs_taken == frame_jobs_queued)
+        break;
+      job = &frame_jobs[frame_jobs_taken++ % n_frame_jobs];
+      pthread_mutex_unlock (&frame_job_lock);
+
+      r = (dctx
+           ? ZSTD_decompressDCtx (dctx, job->out, job->out_len,
+                                  job->in, job->in_len)
+           : (size_t) -1);
+
+      pthread_mutex_lock (&frame_job_lock);
+      job->failed = ZSTD_isError (r) || r != job->out_len;
+      job->done = true;
+      pthread_cond_broadcast (&frame_job_done);
+    }
+  pthread_mutex_unlock (&frame_job_lock);
+
+  ZSTD_freeDCtx (dctx);
+  return NULL;
+}
+
+/* The helper thread, for seekable input decoded in parallel: read the
+   frames from seekable_next_frame on into jobs for the pool, and hand
+   each decoded frame over to the reader as a chunk of its own.  */
+
+static void *
+decompress_frames (void *arg _GL_UNUSED)
+{
+  size_t frame = seekable_next_frame;
+  int err = 0;
+
+  while (true)
+    {
+      struct frame_job *job;
+      struct decompressed_chunk *chunk;
+      char *data;
+      size_t size;
+
+      /* Keep every job busy.  Only this thread changes the number of
+         jobs queued, so it can read it without the lock.  */
+      while (frame_jobs_queued - frame_jobs_collected < n_frame_jobs
+             && frame < seekable_frame_count)
+        {
+          job = &frame_jobs[frame_jobs_queued % n_frame_jobs];
+          job->in_len = (seekable_frames[frame + 1].compressed
+                         - seekable_frames[frame].compressed);
+          job->out_len = (seekable_frames[frame + 1].offset
+                          - seekable_frames[frame].offset);
+          if (job->in_size < job->in_len)
+            {
+              free (job->in);
+              job->in = xmalloc (job->in_size = job->in_len);
+            }
+          if (job->out_size < job->out_len)
+            {
+              free (job->out);
+              job->out = xmalloc (job->out_size = job->out_len);
+            }
+          err = read_compressed (job->in, job->in_len);
+          if (err)
+            break;
+          frame++;
+
+          pthread_mutex_lock (&frame_job_lock);
+          job->done = false;
+          frame_jobs_queued++;
+          pthread_cond_signal (&frame_job_queued);
+          pthread_mutex_unlock (&frame_job_lock);
+        }
+      if (err || frame_jobs_collected == frame_jobs_queued)
+        break;
+
+      job = &frame_jobs[frame_jobs_collected % n_frame_jobs];
+      pthread_mutex_lock (&frame_job_lock);
+      while (! job->done)
+        pthread_cond_wait (&frame_job_done, &frame_job_lock);
+      pthread_mutex_unlock (&frame_job_lock);
+      if (job->failed)
+        {
+          err = EBADMSG;
+          break;
+        }
+
+      /* Swap the decoded frame into a chunk, rather than copying it.  */
+      chunk = free_dchunk ();
+      data = chunk->data;
+      size = chunk->size;
+      chunk->data = job->out;
+      chunk->size = job->out_size;
+      chunk->len = job->out_len;
+      job->out = data;
+      job->out_size = size;
+      frame_jobs_collected++;
+
+      /* Throw away the part before where a seek landed.  */
+      chunk->pos = MIN (decompress_discard, chunk->len);
+      decompress_discard -= chunk->pos;
+      if (chunk->pos < chunk->len)
+        publish_dchunk ();
+    }
+
+  pthread_mutex_lock (&frame_job_lock);
+  frame_jobs_over = true;
+  pthread_cond_broadcast (&frame_job_queued);
+  pthread_mutex_unlock (&frame_job_lock);
+
+  end_dchunks (NULL, err);
+  return NULL;
+}
+
+/* Start the pool that decodes seekable frames, if there is a seek
+   table, more than one processor, and no frame too big to decode
+   whole.  Return true if the frames are to be decoded in parallel.  */
 
 static bool
-advance_input_after_read_error (size_t nbytes)
+start_frame_pool (void)
 {
-  if (! input_seekable)
+  unsigned long int n = num_processors (NPROC_CURRENT_OVERRIDABLE);
+  size_t threads;
+  size_t i;
+
+  if (input_format != FORMAT_ZSTD || ! seekable_frames || n < 2)
+    return false;
+  for (i = seekable_next_frame; i < seekable_frame_count; i++)
+    if (PARALLEL_FRAME_MAX < (seekable_frames[i + 1].offset
+                              - seekable_frames[i].offset)
+        || PARALLEL_FRAME_MAX < (seekable_frames[i + 1].compressed
+                                 - seekable_frames[i].compressed))
+      return false;
+
+  for (threads = 0; threads < n; threads++)
+    {
+      pthread_t thread;
+      if (! start_thread (&thread, decode_frames, NULL))
+        break;
+      pthread_detach (thread);
+    }
+  if (! threads)
+    return false;
+
+  /* Enough jobs to keep every thread busy while the reader drains
+     the decoded frames.  */
+  n_frame_jobs = 2 * threads;
+  frame_jobs = xcalloc (n_frame_jobs, sizeof *frame_jobs);
+  return true;
+}
+# endif
+
+/* Start the helper thread.  */
+
+static void
+start_decompressing (void)
+{
+  void *(*routine) (void *) = decompress_input;
+  pthread_t thread;
+  size_t i;
+
+  for (i = 0; i < DECOMPRESS_CHUNKS; i++)
+    {
+      dchunks[i].data = xmalloc (DECOMPRESS_CHUNK_SIZE);
+      dchunks[i].size = DECOMPRESS_CHUNK_SIZE;
+    }
+
+# if HAVE_ZSTD
+  if (start_frame_pool ())
+    routine = decompress_frames;
+# endif
+
+  if (! start_thread (&thread, routine, NULL))
+    error (EXIT_FAILURE, 0, _("failed to start decompressing %s"),
+           quoteaf (input_file));
+  pthread_detach (thread);
+  decompress_started = true;
+}
+
+/* Wait for the helper thread to fill a chunk, with dchunk_lock held.
+   A signal does not cut the wait short, so wake up every tenth of a
+   second to act on any that have arrived, e.g. when the compressed
+   input is slow to come.  */
+
+static void
+wait_dchunk_filled (void)
+{
+  struct timespec deadline;
+
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += 100 * 1000 * 1000;
+  if (1000 * 1000 * 1000 <= deadline.tv_nsec)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+  if (pthread_cond_timedwait (&dchunk_filled, &dchunk_lock, &deadline)
+      == ETIMEDOUT)
+    {
+      pthread_mutex_unlock (&dchunk_lock);
+      process_signals ();
+      pthread_mutex_lock (&dchunk_lock);
+    }
+}
+
+/* Read up to SIZE bytes of decompressed input into BUF.  Like a read
+   from a regular file, this is short only at the end of the input.  */
+
+static ssize_t
+decompress_read (int fd _GL_UNUSED, void *buf, size_t size)
+{
+  char *p = buf;
+  size_t nread = 0;
+
+  if (! decompress_started)
+    start_decompressing ();
+
+  while (nread < size)
+    {
+      struct decompressed_chunk *chunk;
+      size_t n;
+
+      pthread_mutex_lock (&dchunk_lock);
+      while (dchunk_count == 0 && ! decompress_done)
+        wait_dchunk_filled ();
+      if (dchunk_count == 0)
+        {
+          int err = decompress_errno;
+          pthread_mutex_unlock (&dchunk_lock);
+
+          /* Report any error on the next call.  */
+          if (nread || ! err)
+            break;
+          errno = err;
+          return -1;
+        }
+      chunk = &dchunks[dchunk_head];
+      pthread_mutex_unlock (&dchunk_lock);
+
+      n = MIN (size - nread, chunk->len - chunk->pos);
+      memcpy (p + nread, chunk->data + chunk->pos, n);
+      chunk->pos += n;
+      nread += n;
+
+      if (chunk->pos == chunk->len)
+        {
+          pthread_mutex_lock (&dchunk_lock);
+          dchunk_head = (dchunk_head + 1) % DECOMPRESS_CHUNKS;
+          dchunk_count--;
+          pthread_cond_signal (&dchunk_emptied);
+          pthread_mutex_unlock (&dchunk_lock);
+        }
+    }
+
+  return nread;
+}
+
+/* The decompressed input behaves like a pipe.  */
+
+static ssize_t
+decompress_write (int fd _GL_UNUSED, void const *buf _GL_UNUSED,
+                  size_t size _GL_UNUSED)
+{
+  errno = EBADF;
+  return -1;
+}
+
+/* Seekable zstd input can be skipped forward by OFFSET bytes with
+   SEEK_CUR until it is first read, which is all skip= needs.  Start
+   decoding at the frame that holds the new position, and throw away
+   the part of it before that.  */
+
+static off_t
+decompress_lseek (int fd _GL_UNUSED, off_t offset _GL_UNUSED,
+                  int whence _GL_UNUSED)
+{
+# if HAVE_ZSTD
+  if (seekable_frames && ! decompress_started
+      && whence == SEEK_CUR && 0 < offset)
+    {
+      off_t end = seekable_frames[seekable_frame_count].offset;
+      off_t pos = (end - seekable_position < offset
+                   ? end : seekable_position + offset);
+      size_t lo = 0;
+      size_t hi = seekable_frame_count;
+
+      /* Find the last frame that starts at or before POS.  */
+      while (lo < hi)
+        {
+          size_t mid = hi - (hi - lo) / 2;
+          if (seekable_frames[mid].offset <= pos)
+            lo = mid;
+          else
+            hi = mid - 1;
+        }
+
+      if (raw_input_backend->lseek (fd, seekable_frames[lo].compressed,
+                                    SEEK_SET) < 0)
+        return -1;
+      zin_pos = zin_len = 0;
+      decompress_discard = pos - seekable_frames[lo].offset;
+      seekable_position = pos;
+      seekable_next_frame = lo;
+      return pos;
+    }
+# endif
+
+  errno = ESPIPE;
+  return -1;
+}
+
+static int
+decompress_ftruncate (int fd _GL_UNUSED, off_t length _GL_UNUSED)
+{
+  errno = EINVAL;
+  return -1;
+}
+
+/* The decompressed input looks like a pipe, or like a regular file of
+   the decompressed size if that is known from a seek table.  */
+
+static int
+decompress_fstat (int fd, struct stat *st)
+{
+  if (raw_input_backend->fstat (fd, st) != 0)
+    return -1;
+# if HAVE_ZSTD
+  if (seekable_frames)
+    {
+      st->st_mode = (st->st_mode & ~S_IFMT) | S_IFREG;
+      st->st_size = seekable_frames[seekable_frame_count].offset;
+      return 0;
+    }
+# endif
+  st->st_mode = (st->st_mode & ~S_IFMT) | S_IFIFO;
+  st->st_size = 0;
+  return 0;
+}
+
+static int
+decompress_fsync (int fd _GL_UNUSED)
+{
+  errno = EINVAL;
+  return -1;
+}
+
+static int
+decompress_fadvise (int fd _GL_UNUSED, off_t offset _GL_UNUSED,
+                    off_t len _GL_UNUSED, int advice _GL_UNUSED)
+{
+  errno = ESPIPE;
+  return -1;
+}
+
+static int
+decompress_fallocate (int fd _GL_UNUSED, int mode _GL_UNUSED,
+                      off_t offset _GL_UNUSED, off_t len _GL_UNUSED)
+{
+  errno = ESPIPE;
+  return -1;
+}
+
+static struct io_backend const decompress_io =
+{
+  .read = decompress_read,
+  .write = decompress_write,
+  .lseek = decompress_lseek,
+  .ftruncate = decompress_ftruncate,
+  .fstat = decompress_fstat,
+  .fdatasync = decompress_fsync,
+  .fsync = decompress_fsync,
+  .fadvise = decompress_fadvise,
+  .fallocate = decompress_fallocate,
+  .finish = finish_nothing
+};
+
+# if HAVE_ZSTD
+/* Read SIZE bytes at OFFSET of the input through BACKEND into BUF.
+   Return true if successful.  */
+
+static bool
+read_input_at (struct io_backend const *backend, void *buf, size_t size,
+               off_t offset)
+{
+  char *p = buf;
+
+  if (backend->lseek (STDIN_FILENO, offset, SEEK_SET) < 0)
+    return false;
+  while (size)
+    {
+      ssize_t n = backend->read (STDIN_FILENO, p, size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      p += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* If the zstd input, of which ZIN_LEN bytes have been read through
+   BACKEND, is a seekable regular file with a seek table at its end,
+   fill in seekable_frames from it.  Otherwise, or if the table does
+   not match the file, leave the input to be decompressed in order.  */
+
+static void
+load_seek_table (struct io_backend const *backend)
+{
+  struct stat st;
+  unsigned char footer[SEEK_TABLE_FOOTER_SIZE];
+  unsigned char *table = NULL;
+  uintmax_t entry_size;
+  uintmax_t table_size;
+  off_t table_start;
+  off_t start;
+  off_t compressed;
+  off_t offset;
+  size_t count;
+  size_t i;
+
+  start = backend->lseek (STDIN_FILENO, 0, SEEK_CUR);
+  if (start < 0 || backend->fstat (STDIN_FILENO, &st) != 0
+      || ! usable_st_size (&st))
+    return;
+  start -= zin_len;
+
+  if (st.st_size - start < SKIPPABLE_HEADER_SIZE + SEEK_TABLE_FOOTER_SIZE
+      || ! read_input_at (backend, footer, sizeof footer,
+                          st.st_size - sizeof footer)
+      || get_le32 (footer + 5) != SEEKABLE_MAGIC)
+    goto done;
+
+  count = get_le32 (footer);
+  entry_size = footer[4] & SEEK_TABLE_CHECKSUM ? 12 : 8;
+  table_size = count * entry_size + SEEK_TABLE_FOOTER_SIZE;
+  if ((uintmax_t) (st.st_size - start) < SKIPPABLE_HEADER_SIZE + table_size)
+    goto done;
+  table_start = st.st_size - (SKIPPABLE_HEADER_SIZE + table_size);
+  table = xmalloc (SKIPPABLE_HEADER_SIZE + table_size);
+  if (! read_input_at (backend, table, SKIPPABLE_HEADER_SIZE + table_size,
+                       table_start)
+      || get_le32 (table) != SKIPPABLE_MAGIC
+      || get_le32 (table + 4) != table_size)
+    goto done;
+
+  seekable_frames = xnmalloc (count + 1, sizeof *seekable_frames);
+  compressed = start;
+  offset = 0;
+  for (i = 0; i < count; i++)
+    {
+      unsigned char const *entry = (table + SKIPPABLE_HEADER_SIZE
+                                    + i * entry_size);
+      uint32_t decompressed = get_le32 (entry + 4);
+
+      seekable_frames[i].compressed = compressed;
+      seekable_frames[i].offset = offset;
+      compressed += get_le32 (entry);
+      if (table_start < compressed || OFF_T_MAX - offset < decompressed)
+        break;
+      offset += decompressed;
+    }
+  seekable_frames[i].compressed = compressed;
+  seekable_frames[i].offset = offset;
+  seekable_frame_count = count;
+
+  /* The frames must end where the table starts.  */
+  if (i < count || compressed != table_start)
+    {
+      free (seekable_frames);
+      seekable_frames = NULL;
+    }
+
+ done:
+  free (table);
+  if (backend->lseek (STDIN_FILENO, start + zin_len, SEEK_SET) < 0)
+    error (EXIT_FAILURE, errno, _("%s: cannot seek"), quotef (input_file));
+}
+# endif
+
+/* Return a backend that reads the input from BACKEND decompressed, in
+   whichever format its leading bytes identify.  Uncompressed input
+   passes through unchanged.  Exit if the format is not supported.  */
+
+static struct io_backend const *
+decompress_backend (struct io_backend const *backend)
+{
+  char const *name = NULL;
+  size_t i;
+
+  raw_input_backend = backend;
+  zin = xmalloc (DECOMPRESS_IN_SIZE);
+
+  /* A pipe may deliver the magic number in pieces.  */
+  while (zin_len < MAGIC_MAX)
+    {
+      ssize_t n = backend->read (STDIN_FILENO, zin + zin_len,
+                                 MAGIC_MAX - zin_len);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          error (EXIT_FAILURE, errno, _("error reading %s"),
+                 quoteaf (input_file));
+        }
+      if (n == 0)
+        break;
+      zin_len += n;
+    }
+
+  input_format = FORMAT_NONE;
+  for (i = 0; i < ARRAY_CARDINALITY (input_formats); i++)
+    if (input_formats[i].len <= zin_len
+        && memcmp (zin, input_formats[i].magic, input_formats[i].len) == 0)
+      {
+        input_format = input_formats[i].format;
+        name = input_formats[i].name;
+      }
+
+  switch (input_format)
+    {
+    case FORMAT_NONE:
+      break;
+# if HAVE_ZLIB
+    case FORMAT_GZIP:
+      if (inflateInit2 (&gz_stream, 15 + 16) != Z_OK)
+        xalloc_die ();
+      break;
+# endif
+# if HAVE_LZMA
+    case FORMAT_XZ:
+      if (lzma_stream_decoder (&xz_stream, UINT64_MAX, LZMA_CONCATENATED)
+          != LZMA_OK)
+        xalloc_die ();
+      break;
+# endif
+# if HAVE_ZSTD
+    case FORMAT_ZSTD:
+      zstd_dstream = ZSTD_createDStream ();
+      if (! zstd_dstream || ZSTD_isError (ZSTD_initDStream (zstd_dstream)))
+        xalloc_die ();
+      load_seek_table (backend);
+      break;
+# endif
+# if HAVE_LZ4
+    case FORMAT_LZ4:
+      if (LZ4F_isError (LZ4F_createDecompressionContext (&lz4_dctx,
+                                                         LZ4F_VERSION)))
+        xalloc_die ();
+      break;
+# endif
+    default:
+      error (EXIT_FAILURE, 0, _("%s: %s decompression is not supported"),
+             quotef (input_file), name);
+    }
+
+  return &decompress_io;
+}
+#endif
+
+/* Return the backend to use for FD, the input or the output, once it
+   and any extra outputs have been opened.  Underneath are the plain
+   system calls, or the fault injection backend when testing.  On top
+   of that, the input may be decompressed, and the output may be fanned
+   out to the extra outputs and compressed.  */
+
+static struct io_backend const *
+select_backend (int fd)
+{
+  struct io_backend const *backend = &posix_io;
+
+#ifdef DD_FAULT_INJECTION
+  if (n_faults || short_read_seed)
+    backend = &fault_io;
+#endif
+
+  if (fd == STDIN_FILENO)
+    {
+#if HAVE_DECOMPRESSION
+      if (i_decompress)
+        backend = decompress_backend (backend);
+#endif
+    }
+  else
+    {
+      backend = fanout_backend (backend);
+      if (output_compression)
+        backend = compress_backend (backend);
+    }
+
+  return backend;
+}
+
+/* Return LEN rounded down to a multiple of PAGE_SIZE
+   while storing the remainder internally per FD.
+   Pass LEN == 0 to get the current remainder.  */
+
+static off_t
+cache_round (int fd, off_t len)
+{
+  static off_t i_pending, o_pending;
+  off_t *pending = (fd == STDIN_FILENO ? &i_pending : &o_pending);
+
+  if (len)
+    {
+      uintmax_t c_pending = *pending + len;
+      *pending = c_pending % page_size;
+      if (c_pending > (uintmax_t) *pending)
+        len = c_pending - *pending;
+      else
+        len = 0;
+    }
+  else
+    len = *pending;
+
+  return len;
+}
+
+/* Discard the cache from the current offset of either
+   STDIN_FILENO or STDOUT_FILENO.
+   Return true on success.  */
+
+static bool
+invalidate_cache (int fd, off_t len)
+{
+  int adv_ret = -1;
+
+  /* Minimize syscalls.  */
+  off_t clen = cache_round (fd, len);
+  if (len && !clen)
+    return true; /* Don't advise this time.  */
+  if (!len && !clen && max_records)
+    return true; /* Nothing pending.  */
+  off_t pending = len ? cache_round (fd, 0) : 0;
+
+  if (fd == STDIN_FILENO)
+    {
+      if (input_seekable)
+        {
+          /* Note we're being careful here to only invalidate what
+             we've read, so as not to dump any read ahead cache.  */
+            adv_ret = input_backend->fadvise (fd,
+                                              input_offset - clen - pending,
+                                              clen, POSIX_FADV_DONTNEED);
+        }
+      else
+        errno = ESPIPE;
+    }
+  else if (fd == STDOUT_FILENO)
+    {
+      static off_t output_offset = -2;
+
+      if (output_offset != -1)
+        {
+          if (0 > output_offset)
+            {
+              output_offset = output_backend->lseek (fd, 0, SEEK_CUR);
+              output_offset -= clen + pending;
+            }
+          if (0 <= output_offset)
+            {
+              adv_ret = output_backend->fadvise (fd, output_offset, clen,
+                                                 POSIX_FADV_DONTNEED);
+              output_offset += clen + pending;
+            }
+        }
+    }
+
+  return adv_ret != -1 ? true : false;
+}
+
+/* Process a read of NREAD bytes that asked for SIZE bytes, warning
+   about partial reads if requested.  */
+
+static void
+check_partial_read (ssize_t nread, size_t size)
+{
+  /* Short read may be due to received signal.  */
+  if (0 < nread && nread < size)
+    process_signals ();
+
+  if (0 < nread && warn_partial_read)
+    {
+      static ssize_t prev_nread;
+
+      if (0 < prev_nread && prev_nread < size)
+        {
+          uintmax_t prev = prev_nread;
+          if (status_level != STATUS_NONE)
+            error (0, 0, ngettext (("warning: partial read (%"PRIuMAX" byte); "
+                                    "suggest iflag=fullblock"),
+                                   ("warning: partial read (%"PRIuMAX" bytes); "
+                                    "suggest iflag=fullblock"),
+                                   select_plural (prev)),
+                   prev);
+          warn_partial_read = false;
+        }
+
+      prev_nread = nread;
+    }
+}
+
+/* Read from FD into the buffer BUF of size SIZE, processing any
+   signals that arrive before bytes are read.  Return the number of
+   bytes read if successful, -1 (setting errno) on failure.  */
+
+static ssize_t
+iread (int fd, char *buf, size_t size)
+{
+  ssize_t nread;
+
+  do
+    {
+      process_signals ();
+      nread = fd_backend (fd)->read (fd, buf, size);
+    }
+  while (nread < 0 && errno == EINTR);
+
+  check_partial_read (nread, size);
+
+  return nread;
+}
+
+/* Wrapper around iread function to accumulate full blocks.  */
+static ssize_t
+iread_fullblock (int fd, char *buf, size_t size)
+{
+  ssize_t nread = 0;
+
+  while (0 < size)
+    {
+      ssize_t ncurr = iread (fd, buf, size);
+      if (ncurr < 0)
+        return ncurr;
+      if (ncurr == 0)
+        break;
+      nread += ncurr;
+      buf   += ncurr;
+      size  -= ncurr;
+    }
+
+  return nread;
+}
+
+/* Account for an output write that took LATENCY, then wait as needed
+   so that the average write latency stays near 'latency_target'.
+   Back off exponentially while the target is exceeded, since other
+   users of the device are then being held up; otherwise recover
+   gradually toward full speed.  */
+
+static void
+throttle_output (xtime_t latency)
+{
+  write_latency += (latency - write_latency) / 8;
+
+  if (latency_target < write_latency)
+    write_delay = MIN (MAX (2 * write_delay, XTIME_PRECISION / 1000),
+                       MAX_WRITE_DELAY);
+  else
+    {
+      write_delay -= write_delay / 8;
+      if (write_delay < XTIME_PRECISION / 100000)
+        write_delay = 0;
+    }
+
+  if (write_delay)
+    {
+      struct timespec delay;
+      delay.tv_sec = xtime_sec (write_delay);
+      delay.tv_nsec = xtime_nsec (write_delay);
+      nanosleep (&delay, NULL);
+    }
+}
+
+/* Write to FD the buffer BUF of size SIZE, processing any signals
+   that arrive.  Return the number of bytes written, setting errno if
+   this is less than SIZE.  Keep trying if there are partial
+   writes.  */
+
+static size_t
+iwrite (int fd, char const *buf, size_t size)
+{
+  size_t total_written = 0;
+
+  if ((output_flags & O_DIRECT) && size < output_blocksize)
+    {
+      int old_flags = fcntl (STDOUT_FILENO, F_GETFL);
+      if (fcntl (STDOUT_FILENO, F_SETFL, old_flags & ~O_DIRECT) != 0
+          && status_level != STATUS_NONE)
+        error (0, errno, _("failed to turn off O_DIRECT: %s"),
+               quotef (output_file));
+
+      /* The extra outputs get the same final block.  */
+      size_t i;
+      for (i = 0; i < n_extra_outputs; i++)
+        {
+          old_flags = fcntl (extra_output_fds[i], F_GETFL);
+          if (fcntl (extra_output_fds[i], F_SETFL, old_flags & ~O_DIRECT) != 0
+              && status_level != STATUS_NONE)
+            error (0, errno, _("failed to turn off O_DIRECT: %s"),
+                   quotef (extra_output_files[i]));
+        }
+
+      /* Since we have just turned off O_DIRECT for the final write,
+         here we try to preserve some of its semantics.  First, use
+         posix_fadvise to tell the system not to pollute the buffer
+         cache with this data.  Don't bother to diagnose lseek or
+         posix_fadvise failure. */
+      invalidate_cache (STDOUT_FILENO, 0);
+
+      /* Attempt to ensure that that final block is committed
+         to disk as quickly as possible.  */
+      conversions_mask |= C_FSYNC;
+    }
+
+  while (total_written < size)
+    {
+      ssize_t nwritten = 0;
+      process_signals ();
+
+      /* Perform a seek for a NUL block if sparse output is enabled.  */
+      final_op_was_seek = false;
+      if ((conversions_mask & C_SPARSE) && is_nul (buf, size))
+        {
+          if (output_backend->lseek (fd, size, SEEK_CUR) < 0)
+            {
+              conversions_mask &= ~C_SPARSE;
+              /* Don't warn about the advisory sparse request.  */
+            }
+          else
+            {
+              final_op_was_seek = true;
+              nwritten = size;
+            }
+        }
+
+      if (!nwritten)
+        {
+          xtime_t write_start = latency_target ? gethrxtime () : 0;
+          nwritten = output_backend->write (fd, buf + total_written,
+                                            size - total_written);
+          if (latency_target)
+            throttle_output (gethrxtime () - write_start);
+        }
+
+      if (nwritten < 0)
+        {
+          if (errno != EINTR)
+            break;
+        }
+      else if (nwritten == 0)
+        {
+          /* Some buggy drivers return 0 when one tries to write beyond
+             a device's end.  (Example: Linux kernel 1.2.13 on /dev/fd0.)
+             Set errno to ENOSPC so they get a sensible diagnostic.  */
+          errno = ENOSPC;
+          break;
+        }
+      else
+        total_written += nwritten;
+    }
+
+  if (o_nocache && total_written)
+    invalidate_cache (fd, total_written);
+
+  return total_written;
+}
+
+#if HAVE_ZEROCOPY
+/* Collect the completion notifications of MSG_ZEROCOPY sends from the
+   error queue of the output socket, and give the buffers whose sends
+   have all completed back to the pool.  TCP completes sends in order,
+   so a notification covers every send up to its last.  If the kernel
+   reports that it copied the data after all, as it does for loopback
+   connections, stop asking it not to.  */
+
+static void
+reap_zerocopy (void)
+{
+  while (true)
+    {
+      union
+      {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE (sizeof (struct sock_extended_err)
+                             + sizeof (struct sockaddr_in6))];
+      } control;
+      struct msghdr msg = { .msg_control = control.buf,
+                            .msg_controllen = sizeof control.buf };
+      struct cmsghdr *cm;
+
+      if (recvmsg (STDOUT_FILENO, &msg, MSG_ERRQUEUE) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      for (cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm))
+        if ((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+            || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+          {
+            struct sock_extended_err ee;
+            memcpy (&ee, CMSG_DATA (cm), sizeof ee);
+            if (ee.ee_errno != 0 || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+              continue;
+            if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+              o_zerocopy = false;
+            if (0 < (int32_t) (ee.ee_data + 1 - zerocopy_done))
+              zerocopy_done = ee.ee_data + 1;
+          }
+    }
+
+  while (zerocopy_lent_count
+         && (int32_t) (zerocopy_lent[zerocopy_lent_head].last_send
+                       - zerocopy_done) < 0)
+    {
+      buffer_put (zerocopy_lent[zerocopy_lent_head].buf);
+      zerocopy_lent_head = (zerocopy_lent_head + 1) % ZEROCOPY_LENT_MAX;
+      zerocopy_lent_count--;
+    }
+}
+
+/* Send SIZE bytes at BUF to the output socket with MSG_ZEROCOPY, so
+   that the kernel transmits them from these pages instead of a copy.
+   Return the number of bytes sent.  If a send fails, leave the rest
+   for iwrite, which reports any error that persists; stop using
+   MSG_ZEROCOPY unless the failure was for want of memory to track
+   the pages.  */
+
+static size_t
+zerocopy_block (char const *buf, size_t size)
+{
+  size_t total_sent = 0;
+
+  while (total_sent < size)
+    {
+      process_signals ();
+      xtime_t write_start = latency_target ? gethrxtime () : 0;
+      ssize_t nsent = send (STDOUT_FILENO, buf + total_sent,
+                            size - total_sent, MSG_ZEROCOPY);
+      w_syscalls++;
+      if (latency_target)
+        throttle_output (gethrxtime () - write_start);
+
+      if (nsent < 0 && errno == EINTR)
+        continue;
+      if (nsent <= 0)
+        {
+          if (! (nsent < 0 && errno == ENOBUFS))
+            o_zerocopy = false;
+          break;
+        }
+      zerocopy_sent++;
+      total_sent += nsent;
+    }
+
+  reap_zerocopy ();
+  return total_sent;
+}
+#endif
+
+/* Write SIZE bytes at BUF, in one of our buffers, lending its pages
+   to the output where that saves copying them, by sending them with
+   MSG_ZEROCOPY to a socket.  Set *LENT if any were lent, in which
+   case the buffer must not be written to again until it is replaced
+   with replace_lent.  Return the number of bytes written.  */
+
+static size_t
+write_lent (char const *buf, size_t size, bool *lent)
+{
+  size_t nwritten = 0;
+
+#if HAVE_ZEROCOPY
+  if (o_zerocopy && ZEROCOPY_MIN <= size)
+    nwritten = zerocopy_block (buf, size);
+#endif
+  *lent = nwritten != 0;
+  if (nwritten < size)
+    nwritten += iwrite (STDOUT_FILENO, buf + nwritten, size - nwritten);
+  return nwritten;
+}
+
+/* Replace *BUF, of SIZE bytes, whose pages have been lent to the
+   output.  A buffer with MSG_ZEROCOPY sends in flight waits to go
+   back to the pool until they complete, unless too many are waiting
+   already.  Otherwise the buffer is dropped; the kernel holds on to
+   its pages for as long as it needs them.  */
+
+static void
+replace_lent (char **buf, size_t size)
+{
+#if HAVE_ZEROCOPY
+  if (zerocopy_sent && zerocopy_lent_count < ZEROCOPY_LENT_MAX)
+    {
+      size_t i = (zerocopy_lent_head + zerocopy_lent_count++)
+                 % ZEROCOPY_LENT_MAX;
+      zerocopy_lent[i].buf = *buf;
+      zerocopy_lent[i].last_send = zerocopy_sent - 1;
+    }
+  else
+#endif
+    buffer_drop (*buf);
+
+  *buf = buffer_get (size);
+  if (!*buf)
+    error (EXIT_FAILURE, 0,
+           _("memory exhausted by buffer of size %"PRIuMAX" bytes (%s)"),
+           (uintmax_t) size, human_size (size));
+}
+
+/* Write a full output block from BUF.  If LENDABLE, BUF is in one of
+   our buffers, whose pages may be lent to the output; return true if
+   they were, in which case the caller must replace the buffer.  */
+
+static bool
+write_block (char const *buf, bool lendable)
+{
+  bool lent = false;
+  size_t nwritten = (lendable
+                     ? write_lent (buf, output_blocksize, &lent)
+                     : iwrite (STDOUT_FILENO, buf, output_blocksize));
+  w_bytes += nwritten;
+  if (nwritten != output_blocksize)
+    {
+      error (0, errno, _("writing to %s"), quoteaf (output_file));
+      if (nwritten != 0)
+        w_partial++;
+      quit (EXIT_FAILURE);
+    }
+  else
+    w_full++;
+  return lent;
+}
+
+/* Write, then empty, the output buffer 'obuf'. */
+
+static void
+write_output (void)
+{
+  if (write_block (obuf, true))
+    replace_lent (&obuf, output_blocksize);
+  oc = 0;
+}
+
+/* Restart on EINTR from fd_reopen().  */
+
+static int
+ifd_reopen (int desired_fd, char const *file, int flag, mode_t mode)
+{
+  int ret;
+
+  do
+    {
+      process_signals ();
+      ret = fd_reopen (desired_fd, file, flag, mode);
+    }
+  while (ret < 0 && errno == EINTR);
+
+  return ret;
+}
+
+/* Restart on EINTR from ftruncate().  */
+
+static int
+iftruncate (int fd, off_t length)
+{
+  int ret;
+
+  do
+    {
+      process_signals ();
+      ret = output_backend->ftruncate (fd, length);
+    }
+  while (ret < 0 && errno == EINTR);
+
+  return ret;
+}
+
+/* Return true if STR is of the form "PATTERN" or "PATTERNDELIM...".  */
+
+static bool _GL_ATTRIBUTE_PURE
+operand_matches (char const *str, char const *pattern, char delim)
+{
+  while (*pattern)
+    if (*str++ != *pattern++)
+      return false;
+  return !*str || *str == delim;
+}
+
+/* Interpret one "conv=..." or similar operand STR according to the
+   symbols in TABLE, returning the flags specified.  If the operand
+   cannot be parsed, use ERROR_MSGID to generate a diagnostic.  */
+
+static int
+parse_symbols (char const *str, struct symbol_value const *table,
+               bool exclusive, char const *error_msgid)
+{
+  int value = 0;
+
+  while (true)
+    {
+      char const *strcomma = strchr (str, ',');
+      struct symbol_value const *entry;
+
+      for (entry = table;
+           ! (operand_matches (str, entry->symbol, ',') && entry->value);
+           entry++)
+        {
+          if (! entry->symbol[0])
+            {
+              size_t slen = strcomma ? strcomma - str : strlen (str);
+              error (0, 0, "%s: %s", _(error_msgid),
+                     quotearg_n_style_mem (0, locale_quoting_style, str, slen));
+              usage (EXIT_FAILURE);
+            }
+        }
+
+      if (exclusive)
+        value = entry->value;
+      else
+        value |= entry->value;
+      if (!strcomma)
+        break;
+      str = strcomma + 1;
+    }
+
+  return value;
+}
+
+/* Return the value of STR, interpreted as a non-negative decimal integer,
+   optionally multiplied by various values.
+   Set *INVALID to a nonzero error value if STR does not represent a
+   number in this format.  */
+
+static uintmax_t
+parse_integer (const char *str, strtol_error *invalid)
+{
+  uintmax_t n;
+  char *suffix;
+  strtol_error e = xstrtoumax (str, &suffix, 10, &n, "bcEGkKMPTwYZ0");
+
+  if (e == LONGINT_INVALID_SUFFIX_CHAR && *suffix == 'x')
+    {
+      uintmax_t multiplier = parse_integer (suffix + 1, invalid);
+
+      if (multiplier != 0 && n * multiplier / multiplier != n)
+        {
+          *invalid = LONGINT_OVERFLOW;
+          return 0;
+        }
+
+      n *= multiplier;
+    }
+  else if (e != LONGINT_OK)
+    {
+      *invalid = e;
+      return 0;
+    }
+
+  return n;
+}
+
+/* Interpret an "oflag=FLAGS" operand STR.  It is parsed like iflag=,
+   except that "zstd" and "zstd-seekable" may be followed by ":LEVEL".  */
+
+static int
+parse_output_flags (char const *str)
+{
+  int value = 0;
+  char *copy = xstrdup (str);
+  char *flag = copy;
+
+  while (true)
+    {
+      char *comma = strchr (flag, ',');
+      if (comma)
+        *comma = '\0';
+
+#if HAVE_ZSTD
+      char *level = strchr (flag, ':');
+      if (level && (operand_matches (flag, "zstd", ':')
+                    || operand_matches (flag, "zstd-seekable", ':')))
+        {
+          strtol_error invalid = LONGINT_OK;
+          uintmax_t n = parse_integer (level + 1, &invalid);
+          if (invalid != LONGINT_OK || n < 1 || (uintmax_t) ZSTD_maxCLevel () < n)
+            error (EXIT_FAILURE, 0, "%s: %s",
+                   _("invalid compression level"), quote (level + 1));
+          zstd_level = n;
+          *level = '\0';
+        }
+#endif
+      value |= parse_symbols (flag, flags, false, N_("invalid output flag"));
+
+      if (! comma)
+        break;
+      flag = comma + 1;
+    }
+
+  free (copy);
+  return value;
+}
+
+/* Interpret an "ioprio=CLASS[:LEVEL]" operand STR.  */
+
+static void
+parse_ioprio (char const *str)
+{
+  struct symbol_value const *entry;
+
+  for (entry = ioprio_classes; ; entry++)
+    {
+      if (! entry->symbol[0])
+        {
+          error (0, 0, "%s: %s", _("invalid I/O scheduling class"),
+                 quote (str));
+          usage (EXIT_FAILURE);
+        }
+      if (operand_matches (str, entry->symbol, ':'))
+        break;
+    }
+
+  ioprio_class = entry->value;
+  ioprio_level = IOPRIO_LEVEL_MAX / 2 + 1;
+
+  char const *level = str + strlen (entry->symbol);
+  if (*level == ':')
+    {
+      strtol_error invalid = LONGINT_OK;
+      uintmax_t n = parse_integer (level + 1, &invalid);
+      if (invalid != LONGINT_OK || IOPRIO_LEVEL_MAX < n)
+        error (EXIT_FAILURE, 0, "%s: %s", _("invalid I/O priority level"),
+               quote (level + 1));
+      ioprio_level = n;
+    }
+}
+
+/* Interpret a "numa=NODE" operand STR.  */
+
+static void
+parse_numa (char const *str)
+{
+  if (STREQ (str, "auto"))
+    numa_auto = true;
+  else
+    {
+      strtol_error invalid = LONGINT_OK;
+      uintmax_t n = parse_integer (str, &invalid);
+      if (invalid != LONGINT_OK || NUMA_NODE_MAX < n)
+        error (EXIT_FAILURE, 0, "%s: %s", _("invalid NUMA node"),
+               quote (str));
+      numa_node = n;
+      numa_auto = false;
+    }
+}
+
+#ifdef DD_FAULT_INJECTION
+/* Set up the fault injection backend for the faults listed in SPEC,
+   of the form "KIND[@OFFSET],...", and for pseudo-random short reads
+   seeded by SEED.  Either may be NULL.  */
+
+static void
+parse_faults (char const *spec, char const *seed)
+{
+  char const *str = spec;
+
+  if (seed)
+    short_read_seed = strtoul (seed, NULL, 10);
+
+  while (str && *str)
+    {
+      char const *strcomma = strchr (str, ',');
+      struct symbol_value const *entry;
+      struct fault f = { 0, 0, false };
+
+      for (entry = fault_kinds; ; entry++)
+        {
+          if (! entry->symbol[0])
+            error (EXIT_FAILURE, 0, "%s: %s", _("invalid fault"), quote (str));
+          if (operand_matches (str, entry->symbol, '@')
+              || operand_matches (str, entry->symbol, ','))
+            break;
+        }
+      f.kind = entry->value;
+
+      char const *at = str + strlen (entry->symbol);
+      if (*at == '@')
+        {
+          char *offset = xstrndup (at + 1, strcomma
+                                            ? (size_t) (strcomma - (at + 1))
+                                            : strlen (at + 1));
+          strtol_error invalid = LONGINT_OK;
+          f.offset = parse_integer (offset, &invalid);
+          if (invalid != LONGINT_OK)
+            error (EXIT_FAILURE, 0, "%s: %s", _("invalid fault offset"),
+                   quote (offset));
+          free (offset);
+        }
+
+      faults = xnrealloc (faults, n_faults + 1, sizeof *faults);
+      faults[n_faults++] = f;
+      str = strcomma ? strcomma + 1 : NULL;
+    }
+
+}
+#endif
+
+/* OPERAND is of the form "X=...".  Return true if X is NAME.  */
+
+static bool _GL_ATTRIBUTE_PURE
+operand_is (char const *operand, char const *name)
+{
+  return operand_matches (operand, name, '=');
+}
+
+static void
+scanargs (int argc, char *const *argv)
+{
+  int i;
+  size_t blocksize = 0;
+  uintmax_t count = (uintmax_t) -1;
+  uintmax_t skip = 0;
+  uintmax_t seek = 0;
+  size_t n_alloc = 0;
+
+  for (i = optind; i < argc; i++)
+    {
+      char const *name = argv[i];
+      char const *val = strchr (name, '=');
+
+      if (val == NULL)
+        {
+          error (0, 0, _("unrecognized operand %s"),
+                 quote (name));
+          usage (EXIT_FAILURE);
+        }
+      val++;
+
+      if (operand_is (name, "if"))
+        input_file = val;
+      else if (operand_is (name, "of"))
+        {
+          if (! output_file)
+            output_file = val;
+          else
+            {
+              extra_output_files = x2nrealloc (extra_output_files, &n_alloc,
+                                               sizeof *extra_output_files);
+              extra_output_files[n_extra_outputs++] = val;
+            }
+        }
+      else if (operand_is (name, "conv"))
+        conversions_mask |= parse_symbols (val, conversions, false,
+                                           N_("invalid conversion"));
+      else if (operand_is (name, "iflag"))
+        input_flags |= parse_symbols (val, flags, false,
+                                      N_("invalid input flag"));
+      else if (operand_is (name, "oflag"))
+        output_flags |= parse_output_flags (val);
+      else if (operand_is (name, "status"))
+        status_level = parse_symbols (val, statuses, true,
+                                      N_("invalid status level"));
+      else if (operand_is (name, "stats"))
+        stats_format = parse_symbols (val, stats_formats, true,
+                                      N_("invalid statistics format"));
+      else if (operand_is (name, "ioprio"))
+        parse_ioprio (val);
+      else if (operand_is (name, "numa"))
+        parse_numa (val);
+      else
+        {
+          strtol_error invalid = LONGINT_OK;
+          uintmax_t n = parse_integer (val, &invalid);
+          uintmax_t n_min = 0;
+          uintmax_t n_max = UINTMAX_MAX;
+
+          if (operand_is (name, "ibs"))
+            {
+              n_min = 1;
+              n_max = MAX_BLOCKSIZE (INPUT_BLOCK_SLOP);
+              input_blocksize = n;
+            }
+          else if (operand_is (name, "obs"))
+            {
+              n_min = 1;
+              n_max = MAX_BLOCKSIZE (OUTPUT_BLOCK_SLOP);
+              output_blocksize = n;
+            }
+          else if (operand_is (name, "bs"))
+            {
+              n_min = 1;
+              n_max = MAX_BLOCKSIZE (INPUT_BLOCK_SLOP);
+              blocksize = n;
+            }
+          else if (operand_is (name, "cbs"))
+            {
+              n_min = 1;
+              n_max = SIZE_MAX;
+              conversion_blocksize = n;
+            }
+          else if (operand_is (name, "skip"))
+            skip = n;
+          else if (operand_is (name, "seek"))
+            seek = n;
+          else if (operand_is (name, "count"))
+            count = n;
+          else if (operand_is (name, "latency-target"))
+            {
+              n_max = TYPE_MAXIMUM (xtime_t) / (XTIME_PRECISION / 1000);
+              latency_target = n * (XTIME_PRECISION / 1000);
+            }
+          else
+            {
+              error (0, 0, _("unrecognized operand %s"),
+                     quote (name));
+              usage (EXIT_FAILURE);
+            }
+
+          if (n < n_min)
+            invalid = LONGINT_INVALID;
+          else if (n_max < n)
+            invalid = LONGINT_OVERFLOW;
+
+          if (invalid != LONGINT_OK)
+            error (EXIT_FAILURE, invalid == LONGINT_OVERFLOW ? EOVERFLOW : 0,
+                   "%s: %s", _("invalid number"), quote (val));
+        }
+    }
+
+  if (blocksize)
+    input_blocksize = output_blocksize = blocksize;
+  else
+    {
+      /* POSIX says dd aggregates partial reads into
+         output_blocksize if bs= is not specified.  */
+      conversions_mask |= C_TWOBUFS;
+    }
+
+  if (input_blocksize == 0)
+    input_blocksize = DEFAULT_BLOCKSIZE;
+  if (output_blocksize == 0)
+    output_blocksize = DEFAULT_BLOCKSIZE;
+  if (conversion_blocksize == 0)
+    conversions_mask &= ~(C_BLOCK | C_UNBLOCK);
+
+  if (input_flags & (O_DSYNC | O_SYNC))
+    input_flags |= O_RSYNC;
+
+  if (output_flags & O_FULLBLOCK)
+    {
+      error (0, 0, "%s: %s", _("invalid output flag"), quote ("fullblock"));
+      usage (EXIT_FAILURE);
+    }
+
+  if (input_flags & (O_SEEK_BYTES | O_PREALLOC | O_TEE))
+    {
+      error (0, 0, "%s: %s", _("invalid input flag"),
+             quote (input_flags & O_SEEK_BYTES ? "seek_bytes"
+                    : input_flags & O_PREALLOC ? "prealloc" : "tee"));
+      usage (EXIT_FAILURE);
+    }
+
+  if (output_flags & (O_COUNT_BYTES | O_SKIP_BYTES | O_DECOMPRESS
+                      | O_ASYNC_READ))
+    {
+      error (0, 0, "%s: %s", _("invalid output flag"),
+             quote (output_flags & O_COUNT_BYTES ? "count_bytes"
+                    : output_flags & O_SKIP_BYTES ? "skip_bytes"
+                    : output_flags & O_DECOMPRESS ? "decompress"
+                    : "async"));
+      usage (EXIT_FAILURE);
+    }
+
+  if (input_flags & O_SKIP_BYTES && skip != 0)
+    {
+      skip_records = skip / input_blocksize;
+      skip_bytes = skip % input_blocksize;
+    }
+  else if (skip != 0)
+    skip_records = skip;
+
+  if (input_flags & O_COUNT_BYTES && count != (uintmax_t) -1)
+    {
+      max_records = count / input_blocksize;
+      max_bytes = count % input_blocksize;
+    }
+  else if (count != (uintmax_t) -1)
+    max_records = count;
+
+  if (output_flags & O_SEEK_BYTES && seek != 0)
+    {
+      seek_records = seek / output_blocksize;
+      seek_bytes = seek % output_blocksize;
+    }
+  else if (seek != 0)
+    seek_records = seek;
+
+  /* Warn about partial reads if bs=SIZE is given and iflag=fullblock
+     is not, and if counting or skipping bytes or using direct I/O.
+     This helps to avoid confusion with miscounts, and to avoid issues
+     with direct I/O on GNU/Linux.  */
+  warn_partial_read =
+    (! (conversions_mask & C_TWOBUFS) && ! (input_flags & O_FULLBLOCK)
+     && (skip_records
+         || (0 < max_records && max_records < (uintmax_t) -1)
+         || (input_flags | output_flags) & O_DIRECT));
+
+  iread_fnc = ((input_flags & O_FULLBLOCK)
+               ? iread_fullblock
+               : iread);
+  input_flags &= ~O_FULLBLOCK;
+
+  if (multiple_bits_set (conversions_mask & (C_ASCII | C_EBCDIC | C_IBM)))
+    error (EXIT_FAILURE, 0, _("cannot combine any two of {ascii,ebcdic,ibm}"));
+  if (multiple_bits_set (conversions_mask & (C_BLOCK | C_UNBLOCK)))
+    error (EXIT_FAILURE, 0, _("cannot combine block and unblock"));
+  if (multiple_bits_set (conversions_mask & (C_LCASE | C_UCASE)))
+    error (EXIT_FAILURE, 0, _("cannot combine lcase and ucase"));
+  if (multiple_bits_set (conversions_mask & (C_EXCL | C_NOCREAT)))
+    error (EXIT_FAILURE, 0, _("cannot combine excl and nocreat"));
+  if (multiple_bits_set (input_flags & (O_DIRECT | O_NOCACHE))
+      || multiple_bits_set (output_flags & (O_DIRECT | O_NOCACHE)))
+    error (EXIT_FAILURE, 0, _("cannot combine direct and nocache"));
+
+  if (input_flags & (O_ZSTD | O_ZSTD_SEEKABLE | O_LZ4))
+    {
+      error (0, 0, "%s: %s", _("invalid input flag"),
+             quote (input_flags & O_ZSTD ? "zstd"
+                    : input_flags & O_ZSTD_SEEKABLE ? "zstd-seekable"
+                    : "lz4"));
+      usage (EXIT_FAILURE);
+    }
+  if (output_flags & (O_ZSTD | O_ZSTD_SEEKABLE | O_LZ4))
+    {
+      char const *format = (output_flags & O_ZSTD ? "zstd"
+                            : output_flags & O_ZSTD_SEEKABLE ? "zstd-seekable"
+                            : "lz4");
+      if (multiple_bits_set (output_flags
+                             & (O_ZSTD | O_ZSTD_SEEKABLE | O_LZ4)))
+        error (EXIT_FAILURE, 0,
+               _("cannot combine any two of {zstd,zstd-seekable,lz4}"));
+      if (output_flags & O_DIRECT)
+        error (EXIT_FAILURE, 0, _("cannot combine direct and %s"), format);
+      if (seek_records || seek_bytes)
+        error (EXIT_FAILURE, 0, _("cannot combine seek= and %s"), format);
+      output_compression = (output_flags & O_ZSTD ? COMPRESS_ZSTD
+                            : output_flags & O_ZSTD_SEEKABLE
+                            ? COMPRESS_ZSTD_SEEKABLE : COMPRESS_LZ4);
+      output_flags &= ~(O_ZSTD | O_ZSTD_SEEKABLE | O_LZ4);
+    }
+
+  if (input_flags & O_DECOMPRESS)
+    {
+      if (input_flags & O_DIRECT)
+        error (EXIT_FAILURE, 0, _("cannot combine direct and decompress"));
+      i_decompress = true;
+      input_flags &= ~O_DECOMPRESS;
+    }
+
+  if (input_flags & O_SOCKET)
+    {
+      i_socket = true;
+      input_flags &= ~O_SOCKET;
+    }
+  if (output_flags & O_SOCKET)
+    {
+      o_socket = true;
+      output_flags &= ~O_SOCKET;
+    }
+
+  if (input_flags & O_ASYNC_READ)
+    {
+      /* Recovering from read errors and dropping the cache both need
+         the input offset in step with dd_copy.  */
+      if (conversions_mask & C_NOERROR)
+        error (EXIT_FAILURE, 0, _("cannot combine async and noerror"));
+      if (input_flags & O_NOCACHE)
+        error (EXIT_FAILURE, 0, _("cannot combine async and nocache"));
+      i_async = true;
+      input_flags &= ~O_ASYNC_READ;
+    }
+
+  /* Without oflag=tee, the last of= wins, as it always has.  */
+  if (output_flags & O_TEE)
+    output_flags &= ~O_TEE;
+  else if (n_extra_outputs)
+    {
+      output_file = extra_output_files[n_extra_outputs - 1];
+      n_extra_outputs = 0;
+    }
+
+  if (n_extra_outputs)
+    {
+      /* Every output must get the same bytes at the same offsets.  */
+      if (seek_records || seek_bytes)
+        error (EXIT_FAILURE, 0,
+               _("cannot combine seek= and multiple outputs"));
+      if (conversions_mask & C_SPARSE)
+        error (EXIT_FAILURE, 0,
+               _("cannot combine sparse and multiple outputs"));
+    }
+
+  if (input_flags & O_NOCACHE)
+    {
+      i_nocache = true;
+      input_flags &= ~O_NOCACHE;
+    }
+  if (output_flags & O_NOCACHE)
+    {
+      o_nocache = true;
+      output_flags &= ~O_NOCACHE;
+    }
+}
+
+/* Switch to the I/O scheduling class and level given by ioprio=.
+   Failure is not fatal, as the copy works the same either way.  */
+
+static void
+set_io_priority (void)
+{
+#if defined __linux__ && defined SYS_ioprio_set
+  enum { IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_SHIFT = 13 };
+  int ioprio = (ioprio_class << IOPRIO_CLASS_SHIFT) | ioprio_level;
+  if (syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) == 0)
+    return;
+#else
+  errno = ENOTSUP;
+#endif
+  if (status_level != STATUS_NONE)
+    error (0, errno, _("warning: failed to set I/O priority"));
+}
+
+/* Read the first line of the system file FILE into BUF, of SIZE
+   bytes, without its newline.  Return true if successful.  */
+
+static bool
+read_sys_line (char const *file, char *buf, size_t size)
+{
+  int fd = open (file, O_RDONLY);
+  if (fd < 0)
+    return false;
+  ssize_t n = read (fd, buf, size - 1);
+  close (fd);
+  if (n <= 0)
+    return false;
+  buf[n] = '\0';
+  buf[strcspn (buf, "\n")] = '\0';
+  return true;
+}
+
+/* Return the NUMA node of the device holding the file open on FD,
+   or -1 if that is unknown.  */
+
+static int
+device_numa_node (int fd)
+{
+  /* Where sysfs puts the node, relative to the block device: on the
+     device itself, on its controller (e.g. NVMe), or on those of the
+     whole disk when the device is a partition.  */
+  static char const *const node_files[] =
+    {
+      "device/numa_node",
+      "device/device/numa_node",
+      "../device/numa_node",
+      "../device/device/numa_node"
+    };
+  struct stat st;
+  dev_t dev;
+  size_t i;
+
+  if (fd_backend (fd)->fstat (fd, &st) != 0)
+    return -1;
+  if (S_ISBLK (st.st_mode))
+    dev = st.st_rdev;
+  else if (S_ISREG (st.st_mode))
+    dev = st.st_dev;
+  else
+    return -1;
+
+  for (i = 0; i < ARRAY_CARDINALITY (node_files); i++)
+    {
+      char file[sizeof "/sys/dev/block/:/" + 2 * INT_STRLEN_BOUND (int)
+                + sizeof "../device/device/numa_node"];
+      char buf[INT_BUFSIZE_BOUND (int)];
+      char *end;
+      long int node;
+
+      snprintf (file, sizeof file, "/sys/dev/block/%u:%u/%s",
+                (unsigned int) major (dev), (unsigned int) minor (dev),
+                node_files[i]);
+      if (read_sys_line (file, buf, sizeof buf))
+        {
+          node = strtol (buf, &end, 10);
+          if (end != buf && !*end && 0 <= node && node <= NUMA_NODE_MAX)
+            return node;
+        }
+    }
+
+  return -1;
+}
+
+/* Add the CPUs in the sysfs cpulist LIST, e.g. "0-3,8-11", to SET.
+   Return the number added.  */
+
+static int
+parse_cpulist (char const *list, cpu_set_t *set)
+{
+  int n = 0;
+
+  while (*list)
+    {
+      char *end;
+      unsigned long int first = strtoul (list, &end, 10);
+      unsigned long int last = first;
+      if (end == list)
+        break;
+      if (*end == '-')
+        {
+          list = end + 1;
+          last = strtoul (list, &end, 10);
+          if (end == list)
+            break;
+        }
+      for (; first <= last && first < CPU_SETSIZE; first++, n++)
+        CPU_SET (first, set);
+      list = end + (*end == ',');
+    }
+
+  return n;
+}
+
+/* Prefer memory on NUMA node NODE for the buffers allocated from now
+   on, and run on its CPUs.  Threads started later inherit both.  */
+
+static void
+bind_numa_node (int node)
+{
+#if defined __linux__ && defined SYS_set_mempolicy
+  enum { MPOL_PREFERRED = 1 };
+  unsigned long int nodemask[(NUMA_NODE_MAX + 1)
+                             / (CHAR_BIT * sizeof (unsigned long int))];
+  size_t bits = CHAR_BIT * sizeof *nodemask;
+  char file[sizeof "/sys/devices/system/node/node/cpulist"
+            + INT_STRLEN_BOUND (int)];
+  char cpulist[4096];
+  cpu_set_t cpus;
+
+  memset (nodemask, 0, sizeof nodemask);
+  nodemask[node / bits] = 1UL << (node % bits);
+
+  /* The kernel uses one fewer bit than it is told.  */
+  if (syscall (SYS_set_mempolicy, MPOL_PREFERRED, nodemask,
+               CHAR_BIT * sizeof nodemask + 1) != 0)
+    goto fail;
+
+  snprintf (file, sizeof file, "/sys/devices/system/node/node%d/cpulist",
+            node);
+  CPU_ZERO (&cpus);
+  if (! read_sys_line (file, cpulist, sizeof cpulist))
+    goto fail;
+  if (parse_cpulist (cpulist, &cpus) == 0)
+    return;
+  if (sched_setaffinity (0, sizeof cpus, &cpus) == 0)
+    return;
+ fail:
+#else
+  errno = ENOTSUP;
+#endif
+  if (status_level != STATUS_NONE)
+    error (0, errno, _("warning: failed to bind to NUMA node %d"), node);
+}
+
+/* If FD is a pipe too small to hold a block of BLOCKSIZE bytes, grow
+   it to that size, within the limit in /proc/sys/fs/pipe-max-size.
+   The default 64 KiB pipe splits bigger blocks into partial reads and
+   writes, each a context switch between dd and the process at the
+   other end.  Pipes that already hold a block are left alone, as
+   pipe buffers count against a per-user quota.  Never shrink the
+   pipe, and settle for less if the kernel refuses, e.g. because the
+   user has used up their share of pipe buffers.  */
+
+static void
+grow_pipe (int fd, size_t blocksize)
+{
+#ifdef F_SETPIPE_SZ
+  char buf[INT_BUFSIZE_BOUND (long int)];
+  struct stat st;
+  size_t size = MIN (blocksize, INT_MAX);
+  int current;
+
+  if (fstat (fd, &st) != 0 || ! S_ISFIFO (st.st_mode))
+    return;
+  current = fcntl (fd, F_GETPIPE_SZ);
+  if (current < 0 || size <= (size_t) current)
+    return;
+
+  if (read_sys_line ("/proc/sys/fs/pipe-max-size", buf, sizeof buf))
+    {
+      char *end;
+      long int max = strtol (buf, &end, 10);
+      if (end != buf && !*end && 0 < max)
+        size = MIN (size, (unsigned long int) max);
+    }
+
+  for (; (size_t) current < size; size /= 2)
+    if (0 <= fcntl (fd, F_SETPIPE_SZ, (int) size))
+      break;
+#endif
+}
+
+/* Open the socket endpoint FILE, "unix:PATH" or "tcp:HOST:PORT", on
+   DESIRED_FD unless that is negative, and return its file descriptor.
+   For the output, connect to it.  For the input, if ACCEPTING, listen
+   on it instead and accept a single connection; a "unix:" socket is
+   removed once that is made.  So one dd can receive what another
+   sends, with no helper process to copy the data in between.  An
+   empty HOST is the loopback interface, so that a listener is not
+   open to the network unless asked for.  A host name can stand for
+   several addresses, e.g. both "::1" and "127.0.0.1" for "localhost",
+   so connect to the first that takes the connection, or listen on
+   all of them and accept on whichever is reached first.  Exit on
+   failure.  */
+
+static int
+open_socket (int desired_fd, char const *file, bool accepting)
+{
+  enum { LISTENERS_MAX = 8 };
+  struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+  struct addrinfo *ai = NULL;
+  struct sockaddr_un sun = { .sun_family = AF_UNIX };
+  struct addrinfo unix_ai = { .ai_family = AF_UNIX,
+                              .ai_socktype = SOCK_STREAM,
+                              .ai_addr = (struct sockaddr *) &sun,
+                              .ai_addrlen = sizeof sun };
+  struct addrinfo const *p = NULL;
+  struct pollfd listeners[LISTENERS_MAX];
+  nfds_t n_listeners = 0;
+  nfds_t i;
+  char const *path = NULL;
+  int fd = -1;
+  int saved_errno = 0;
+
+  if (STRPREFIX (file, "unix:"))
+    {
+      path = file + sizeof "unix:" - 1;
+      if (sizeof sun.sun_path <= strlen (path))
+        error (EXIT_FAILURE, ENAMETOOLONG, "%s", quotef (file));
+      strcpy (sun.sun_path, path);
+      p = &unix_ai;
+    }
+  else if (STRPREFIX (file, "tcp:"))
+    {
+      char const *spec = file + sizeof "tcp:" - 1;
+      char const *port = strrchr (spec, ':');
+      char *host;
+      int err;
+
+      if (! port)
+        error (EXIT_FAILURE, 0, _("%s: missing port"), quotef (file));
+      host = (spec[0] == '[' && port[-1] == ']'
+              ? xstrndup (spec + 1, port - spec - 2)
+              : xstrndup (spec, port - spec));
+      err = getaddrinfo (*host ? host : NULL, port + 1, &hints, &ai);
+      free (host);
+      if (err != 0)
+        error (EXIT_FAILURE, err == EAI_SYSTEM ? errno : 0, "%s: %s",
+               quotef (file), gai_strerror (err));
+      p = ai;
+    }
+  else
+    error (EXIT_FAILURE, 0, _("%s: not unix:PATH or tcp:HOST:PORT"),
+           quotef (file));
+
+  for (; p; p = p->ai_next)
+    {
+      fd = socket (p->ai_family, SOCK_STREAM, 0);
+      if (fd < 0)
+        {
+          saved_errno = errno;
+          continue;
+        }
+
+      if (accepting)
+        {
+          int one = 1;
+          if (! path)
+            setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+          if (bind (fd, p->ai_addr, p->ai_addrlen) == 0 && listen (fd, 1) == 0)
+            {
+              listeners[n_listeners].fd = fd;
+              listeners[n_listeners].events = POLLIN;
+              if (++n_listeners == LISTENERS_MAX)
+                break;
+              continue;
+            }
+        }
+      else
+        {
+          int ret;
+          do
+            {
+              process_signals ();
+              ret = connect (fd, p->ai_addr, p->ai_addrlen);
+            }
+          while (ret != 0 && errno == EINTR);
+          if (ret == 0)
+            break;
+        }
+
+      saved_errno = errno;
+      close (fd);
+      fd = -1;
+    }
+
+  if (ai)
+    freeaddrinfo (ai);
+  if (accepting ? n_listeners == 0 : fd < 0)
+    error (EXIT_FAILURE, saved_errno,
+           (accepting ? _("failed to listen on %s")
+            : _("failed to connect to %s")),
+           quoteaf (file));
+
+  if (accepting)
+    {
+      int ret;
+      do
+        {
+          process_signals ();
+          ret = poll (listeners, n_listeners, -1);
+        }
+      while (ret < 0 && errno == EINTR);
+      fd = -1;
+      if (0 < ret)
+        for (i = 0; i < n_listeners; i++)
+          if (listeners[i].revents)
+            {
+              do
+                {
+                  process_signals ();
+                  fd = accept (listeners[i].fd, NULL, NULL);
+                }
+              while (fd < 0 && errno == EINTR);
+              break;
+            }
+      if (fd < 0)
+        error (EXIT_FAILURE, errno, _("failed to accept on %s"),
+               quoteaf (file));
+      for (i = 0; i < n_listeners; i++)
+        close (listeners[i].fd);
+      if (path)
+        unlink (path);
+    }
+
+  if (0 <= desired_fd && fd != desired_fd)
+    {
+      if (dup2 (fd, desired_fd) < 0)
+        error (EXIT_FAILURE, errno, _("failed to open %s"), quoteaf (file));
+      close (fd);
+      fd = desired_fd;
+    }
+  return fd;
+}
+
+/* If FD is a socket, tune it for blocks of BLOCKSIZE bytes.  For the
+   input, have each read wait until a whole block has arrived rather
+   than returning whatever the last packet brought.  For the output,
+   send from dd's own buffers with MSG_ZEROCOPY where the socket
+   supports it.  Failure only costs speed, so ignore it.  */
+
+static void
+tune_socket (int fd, size_t blocksize)
+{
+  struct stat st;
+
+  if (fstat (fd, &st) != 0 || ! S_ISSOCK (st.st_mode))
+    return;
+
+  if (fd == STDIN_FILENO)
+    {
+      int lowat = MIN (blocksize, INT_MAX);
+      setsockopt (fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof lowat);
+    }
+#if HAVE_ZEROCOPY
+  else
+    {
+      int one = 1;
+      o_zerocopy = (output_backend == &posix_io
+                    && setsockopt (fd, SOL_SOCKET, SO_ZEROCOPY,
+                                   &one, sizeof one) == 0);
+    }
+#endif
+}
+
+/* Fix up translation table. */
+
+static void
+apply_translations (void)
+{
+  int i;
+
+  if (conversions_mask & C_ASCII)
+    translate_charset (ebcdic_to_ascii);
+
+  if (conversions_mask & C_UCASE)
+    {
+      for (i = 0; i < 256; i++)
+        trans_table[i] = toupper (trans_table[i]);
+      translation_needed = true;
+    }
+  else if (conversions_mask & C_LCASE)
+    {
+      for (i = 0; i < 256; i++)
+        trans_table[i] = tolower (trans_table[i]);
+      translation_needed = true;
+    }
+
+  if (conversions_mask & C_EBCDIC)
+    {
+      translate_charset (ascii_to_ebcdic);
+      newline_character = ascii_to_ebcdic['\n'];
+      space_character = ascii_to_ebcdic[' '];
+    }
+  else if (conversions_mask & C_IBM)
+    {
+      translate_charset (ascii_to_ibm);
+      newline_character = ascii_to_ibm['\n'];
+      space_character = ascii_to_ibm[' '];
+    }
+}
+
+/* Swap each pair of bytes among the N bytes in BUF, N being even.  */
+
+static void
+swab_pairs (char *buf, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i += 2)
+    {
+      char c = buf[i];
+      buf[i] = buf[i + 1];
+      buf[i + 1] = c;
+    }
+}
+
+#ifdef __SSE2__
+/* Whether copy_simple fills the output buffer with non-temporal
+   stores, which bypass the cache.  This is for output blocks too big
+   to stay cached until they are written out, which would only evict
+   more useful data, from dd and from everything else on the machine.
+   Conversions done in place in the input buffer keep to ordinary
+   stores, as what they write is read again straight away, by the
+   copy or by the write.  */
+static bool streaming_stores;
+
+/* The number of bytes from P to the next multiple of 16.  */
+# define STREAM_PROLOGUE(P) (-(uintptr_t) (P) & 15)
+
+/* Copy N bytes from SRC to DST with non-temporal stores.  */
+
+static void
+stream_copy (char *dst, char const *src, size_t n)
+{
+  size_t head = MIN (n, STREAM_PROLOGUE (dst));
+
+  memcpy (dst, src, head);
+  dst += head;
+  src += head;
+  n -= head;
+
+  for (; 16 <= n; n -= 16, dst += 16, src += 16)
+    _mm_stream_si128 ((__m128i *) dst,
+                      _mm_loadu_si128 ((__m128i const *) src));
+
+  memcpy (dst, src, n);
+  _mm_sfence ();
+}
+
+/* Return the size in bytes of the last-level cache, or 0 if it is not
+   known.  */
+
+static size_t
+last_level_cache_size (void)
+{
+  long size = -1;
+# ifdef _SC_LEVEL3_CACHE_SIZE
+  size = sysconf (_SC_LEVEL3_CACHE_SIZE);
+# endif
+# ifdef _SC_LEVEL2_CACHE_SIZE
+  if (size <= 0)
+    size = sysconf (_SC_LEVEL2_CACHE_SIZE);
+# endif
+  return MAX (size, 0);
+}
+#endif
+
+/* The conversion kernels split a big buffer into parts, to be
+   converted in parallel by a pool of threads, if each part would get
+   at least this many bytes.  */
+#define PARALLEL_PART_MIN (256 * 1024)
+
+/* A part of a buffer being converted in parallel.  */
+struct conv_part
+{
+  /* The input.  */
+  char *buf;
+  size_t len;
+
+  /* 'col' and 'pending_spaces' at the start of the part, and after
+     converting its first USED bytes.  */
+  size_t col;
+  size_t pending_spaces;
+
+  /* The number of bytes of the input converted, for conv=block and
+     conv=unblock.  This is less than LEN if the output ran out of
+     room.  */
+  size_t used;
+
+  /* The number of records truncated, for conv=block.  */
+  uintmax_t truncated;
+
+  /* The output, for conv=block and conv=unblock, of OUT_LEN bytes in
+     a buffer of OUT_SIZE bytes that is kept across calls.  */
+  char *out;
+  size_t out_len;
+  size_t out_size;
+};
+
+/* Like output_char, but append C to the output of part P, which must
+   have room for it.  */
+#define part_char(p, c) ((p)->out[(p)->out_len++] = (c))
+
+/* Whether part P is sure to have room in its output for whatever the
+   next byte of input makes, which is at most a record and a newline.
+   Otherwise try to make room with part_room.  */
+#define part_has_room(p) \
+  (conversion_blocksize < (p)->out_size - (p)->out_len)
+
+/* Make room in the output of part P for whatever the next byte of
+   input makes.  conv=block can make a whole record of every byte, so
+   let the output grow to about twice the size of the input at most;
+   return false if that is not enough.  The rest of the input is then
+   left to the single-threaded kernel, which writes out as it goes.  */
+
+static bool
+part_room (struct conv_part *p)
+{
+  size_t need = p->out_len + conversion_blocksize + 1;
+  size_t limit = 2 * (p->len + conversion_blocksize + 1);
+
+  if (need <= p->out_size)
+    return true;
+  if (limit < need)
+    return false;
+  p->out_size = MAX (need, MIN (2 * p->out_size, limit));
+  p->out = xrealloc (p->out, p->out_size);
+  return true;
+}
+
+/* The parts of the buffer being converted, one per thread at most.  */
+static struct conv_part *conv_parts;
+
+/* The number of threads that convert, counting the main thread.
+   Zero until the pool is started.  */
+static size_t conv_threads;
+
+/* The job that the pool is running: call CONV_JOB for each part
+   number below CONV_JOB_PARTS.  CONV_JOB_NEXT is the next part to
+   claim, and CONV_JOB_RUNNING counts the parts not yet done.
+   CONV_JOB_ID changes with each new job.  */
+static void (*conv_job) (size_t);
+static size_t conv_job_parts;
+static size_t conv_job_next;
+static size_t conv_job_running;
+static uintmax_t conv_job_id;
+
+static pthread_mutex_t conv_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t conv_job_posted = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t conv_job_done = PTHREAD_COND_INITIALIZER;
+
+/* Claim and convert parts of the current job until none are left.
+   Call with conv_lock held.  */
+
+static void
+work_on_conv_job (void)
+{
+  while (conv_job_next < conv_job_parts)
+    {
+      size_t k = conv_job_next++;
+      pthread_mutex_unlock (&conv_lock);
+      conv_job (k);
+      pthread_mutex_lock (&conv_lock);
+      if (--conv_job_running == 0)
+        pthread_cond_signal (&conv_job_done);
+    }
+}
+
+/* A thread of the pool.  */
+
+static void *
+conv_worker (void *arg _GL_UNUSED)
+{
+  uintmax_t id = 0;
+
+  pthread_mutex_lock (&conv_lock);
+  while (true)
+    {
+      while (conv_job_id == id)
+        pthread_cond_wait (&conv_job_posted, &conv_lock);
+      id = conv_job_id;
+      work_on_conv_job ();
+    }
+  return NULL;
+}
+
+/* Return the number of parts to split a buffer of NBYTES bytes into,
+   starting the pool if it is worth it and not started yet.  */
+
+static size_t
+conv_part_count (size_t nbytes)
+{
+  if (nbytes / PARALLEL_PART_MIN < 2)
+    return 1;
+
+  if (! conv_threads)
+    {
+      unsigned long int n = num_processors (NPROC_CURRENT_OVERRIDABLE);
+      conv_parts = xcalloc (n, sizeof *conv_parts);
+      for (conv_threads = 1; conv_threads < n; conv_threads++)
+        {
+          pthread_t thread;
+          if (! start_thread (&thread, conv_worker, NULL))
+            break;
+          pthread_detach (thread);
+        }
+    }
+
+  return MIN (conv_threads, nbytes / PARALLEL_PART_MIN);
+}
+
+/* Split the N bytes of BUF into NPARTS parts, each but the last
+   a multiple of GRANULE bytes long.  */
+
+static void
+split_conv_parts (char *buf, size_t n, size_t nparts, size_t granule)
+{
+  size_t part_len = n / nparts / granule * granule;
+  size_t k;
+
+  for (k = 0; k < nparts; k++)
+    {
+      conv_parts[k].buf = buf + k * part_len;
+      conv_parts[k].len = k + 1 < nparts ? part_len : n - k * part_len;
+    }
+}
+
+/* Call JOB for each of the first NPARTS parts, in parallel, and wait
+   until all are done.  */
+
+static void
+run_conv_job (void (*job) (size_t), size_t nparts)
+{
+  pthread_mutex_lock (&conv_lock);
+  conv_job = job;
+  conv_job_parts = nparts;
+  conv_job_next = 0;
+  conv_job_running = nparts;
+  conv_job_id++;
+  pthread_cond_broadcast (&conv_job_posted);
+  work_on_conv_job ();
+  while (conv_job_running)
+    pthread_cond_wait (&conv_job_done, &conv_lock);
+  pthread_mutex_unlock (&conv_lock);
+}
+
+/* Translate the N bytes in BUF.  */
+
+static void
+translate_range (char *buf, size_t n)
+{
+  char *cp;
+  size_t i;
+
+  for (i = n, cp = buf; i; i--, cp++)
+    *cp = trans_table[to_uchar (*cp)];
+}
+
+static void
+translate_job (size_t k)
+{
+  translate_range (conv_parts[k].buf, conv_parts[k].len);
+}
+
+/* Apply the character-set translations specified by the user
+   to the NREAD bytes in BUF.  */
+
+static void
+translate_buffer (char *buf, size_t nread)
+{
+  size_t nparts = conv_part_count (nread);
+
+  if (1 < nparts)
+    {
+      split_conv_parts (buf, nread, nparts, 1);
+      run_conv_job (translate_job, nparts);
+    }
+  else
+    translate_range (buf, nread);
+}
+
+static void
+swab_job (size_t k)
+{
+  swab_pairs (conv_parts[k].buf, conv_parts[k].len);
+}
+
+/* If true, the last char from the previous call to 'swab_buffer'
+   is saved in 'saved_char'.  */
+static bool char_is_saved = false;
+
+/* Odd char from previous call.  */
+static char saved_char;
+
+/* Swap NREAD bytes in BUF, plus possibly an initial char from the
+   previous call.  If NREAD is odd, save the last char for the
+   next call.   Return the new start of the BUF buffer.  */
+
+static char *
+swab_buffer (char *buf, size_t *nread)
+{
+  char *bufstart = buf;
+  char *cp;
+  size_t i;
+  size_t nparts;
+
+  /* Is a char left from last time?  */
+  if (char_is_saved)
+    {
+      *--bufstart = saved_char;
+      (*nread)++;
+      char_is_saved = false;
+    }
+
+  if (*nread & 1)
+    {
+      /* An odd number of chars are in the buffer.  */
+      saved_char = bufstart[--*nread];
+      char_is_saved = true;
+    }
+
+  /* Swapping the pairs in place instead lets parts of the buffer be
+     swapped independently.  */
+  nparts = conv_part_count (*nread);
+  if (1 < nparts)
+    {
+      split_conv_parts (bufstart, *nread, nparts, 2);
+      run_conv_job (swab_job, nparts);
+      return bufstart;
+    }
+
+  /* Do the byte-swapping by moving every second character two
+     positions toward the end, working from the end of the buffer
+     toward the beginning.  This way we only move half of the data.  */
+
+  cp = bufstart + *nread;	/* Start one char past the last.  */
+  for (i = *nread / 2; i; i--, cp -= 2)
+    *cp = *(cp - 2);
+
+  return ++bufstart;
+}
+
+/* Add OFFSET to the input offset, setting the overflow flag if
+   necessary.  */
+
+static void
+advance_input_offset (uintmax_t offset)
+{
+  input_offset += offset;
+  if (input_offset < offset)
+    input_offset_overflow = true;
+}
+
+/* This is a wrapper for lseek.  It detects and warns about a kernel
+   bug that makes lseek a no-op for tape devices, even though the kernel
+   lseek return value suggests that the function succeeded.
+
+   The parameters are the same as those of the lseek function, but
+   with the addition of FILENAME, the name of the file associated with
+   descriptor FDESC.  The file name is used solely in the warning that's
+   printed when the bug is detected.  Return the same value that lseek
+   would have returned, but when the lseek bug is detected, return -1
+   to indicate that lseek failed.
+
+   The offending behavior has been confirmed with an Exabyte SCSI tape
+   drive accessed via /dev/nst0 on both Linux 2.2.17 and 2.4.16 kernels.  */
+
+#ifdef __linux__
+
+# include <sys/mtio.h>
+
+# define MT_SAME_POSITION(P, Q) \
+   ((P).mt_resid == (Q).mt_resid \
+    && (P).mt_fileno == (Q).mt_fileno \
+    && (P).mt_blkno == (Q).mt_blkno)
+
+static off_t
+skip_via_lseek (char const *filename, int fdesc, off_t offset, int whence)
+{
+  struct mtget s1;
+  struct mtget s2;
+  bool got_original_tape_position = (ioctl (fdesc, MTIOCGET, &s1) == 0);
+  /* known bad device type */
+  /* && s.mt_type == MT_ISSCSI2 */
+
+  off_t new_position = fd_backend (fdesc)->lseek (fdesc, offset, whence);
+  if (0 <= new_position
+      && got_original_tape_position
+      && ioctl (fdesc, MTIOCGET, &s2) == 0
+      && MT_SAME_POSITION (s1, s2))
+    {
+      if (status_level != STATUS_NONE)
+        error (0, 0, _("warning: working around lseek kernel bug for file "
+                       "(%s)\n  of mt_type=0x%0lx -- "
+                       "see <sys/mtio.h> for the list of types"),
+               filename, s2.mt_type + 0Lu);
+      errno = 0;
+      new_position = -1;
+    }
+
+  return new_position;
+}
+#else
+# define skip_via_lseek(Filename, Fd, Offset, Whence) \
+   fd_backend (Fd)->lseek (Fd, Offset, Whence)
+#endif
+
+#if defined __linux__ && defined SPLICE_F_MOVE
+/* Throw away *RECORDS blocks of BLOCKSIZE bytes plus *BYTES bytes of
+   the input, which is open as FDESC, by splicing them into /dev/null
+   so that they are never copied to user space.  Each splice stands in
+   for a read, so records are counted just as by reading them with
+   'iread_fnc', except that with iflag=fullblock many records are moved
+   per call.  Advance the input offset, and update *RECORDS and *BYTES
+   to what was not skipped because EOF was reached.  Return false if
+   splicing is not possible here, e.g. because the input is not a pipe;
+   the caller should then read instead.  */
+
+static bool
+skip_via_splice (int fdesc, char const *file, uintmax_t *records,
+                 size_t blocksize, size_t *bytes)
+{
+  bool fullblock = iread_fnc == iread_fullblock;
+  bool spliced = false;
+
+  int null_fd = open ("/dev/null", O_WRONLY);
+  if (null_fd < 0)
+    return false;
+
+  while (*records || *bytes)
+    {
+      size_t size = (! *records ? *bytes
+                     : fullblock ? MIN (*records, SSIZE_MAX / blocksize) * blocksize
+                     : blocksize);
+      size_t nskipped = 0;
+
+      do
+        {
+          process_signals ();
+          ssize_t n = splice (fdesc, NULL, null_fd, NULL, size - nskipped,
+                              SPLICE_F_MOVE);
+          r_syscalls++;
+          if (n < 0)
+            {
+              if (errno == EINTR)
+                continue;
+              if (! spliced)
+                {
+                  close (null_fd);
+                  return false;
+                }
+              error (0, errno, _("error reading %s"), quoteaf (file));
+              if (conversions_mask & C_NOERROR)
+                print_stats ();
+              quit (EXIT_FAILURE);
+            }
+          spliced = true;
+          if (n == 0)
+            break;
+          nskipped += n;
+          if (! fullblock)
+            check_partial_read (n, size);
+        }
+      while (fullblock && nskipped < size);
+
+      advance_input_offset (nskipped);
+
+      if (! *records)
+        {
+          if (nskipped)
+            *bytes = 0;
+        }
+      else if (fullblock)
+        *records -= nskipped / blocksize + (nskipped % blocksize != 0);
+      else if (nskipped)
+        (*records)--;
+
+      if (nskipped == 0 || (fullblock && nskipped < size))
+        break;
+    }
+
+  close (null_fd);
+  return true;
+}
+
+/* When nothing is converted and there are several outputs, the data
+   need not pass through user space at all.  Each block is spliced
+   from the input into a private pipe, 'fanout_pipe'.  For each extra
+   output, tee duplicates it into a second private pipe, 'fanout_copy',
+   from which it is spliced to that output; then the first output takes
+   it from 'fanout_pipe'.  Both pipes hold a whole block, so neither
+   splicing into the first nor teeing into the second, which is empty
+   each time, can stop short for want of room.  */
+
+static int fanout_pipe[2];
+static int fanout_copy[2];
+
+/* Return true if splice can move data to or from the file with
+   status ST.  */
+
+static bool
+splices (struct stat const *st)
+{
+  return S_ISFIFO (st->st_mode) || S_ISREG (st->st_mode)
+         || S_ISSOCK (st->st_mode);
+}
+
+/* Set up the private pipes, and return true, if the copy can be done
+   by splicing the data to every output.  */
+
+static bool
+start_splice_fanout (void)
+{
+  struct stat st;
+  size_t i;
+
+  if (! n_extra_outputs
+      || (conversions_mask & (C_TWOBUFS | C_SYNC | C_NOERROR))
+      || iread_fnc != iread || i_async || i_nocache || o_nocache
+      || latency_target || ((input_flags | output_flags) & O_DIRECT)
+      || (output_flags & O_APPEND)
+      || input_backend != &posix_io || output_backend != &fanout_io
+      || fanned_backend != &posix_io)
+    return false;
+
+  if (fstat (STDIN_FILENO, &st) != 0 || ! splices (&st)
+      || fstat (STDOUT_FILENO, &st) != 0 || ! splices (&st))
+    return false;
+  for (i = 0; i < n_extra_outputs; i++)
+    if (fstat (extra_output_fds[i], &st) != 0 || ! splices (&st))
+      return false;
+
+  /* A block that does not start on a page boundary of a regular file
+     spans one more page.  */
+  if (INT_MAX - page_size < input_blocksize)
+    return false;
+  int size = input_blocksize + page_size;
+
+  if (pipe2 (fanout_pipe, O_CLOEXEC) != 0)
+    return false;
+  if (pipe2 (fanout_copy, O_CLOEXEC) == 0)
+    {
+      fcntl (fanout_pipe[1], F_SETPIPE_SZ, size);
+      fcntl (fanout_copy[1], F_SETPIPE_SZ, size);
+      int pipe_size = fcntl (fanout_pipe[1], F_GETPIPE_SZ);
+      if (size <= pipe_size
+          && pipe_size <= fcntl (fanout_copy[1], F_GETPIPE_SZ))
+        return true;
+      close (fanout_copy[0]);
+      close (fanout_copy[1]);
+    }
+  close (fanout_pipe[0]);
+  close (fanout_pipe[1]);
+  return false;
+}
+
+/* Splice up to SIZE bytes of the input into 'fanout_pipe', standing
+   in for a read of them with iread.  */
+
+static ssize_t
+splice_input (size_t size)
+{
+  ssize_t nread;
+
+  do
+    {
+      process_signals ();
+      nread = splice (STDIN_FILENO, NULL, fanout_pipe[1], NULL, size,
+                      SPLICE_F_MOVE);
+      r_syscalls++;
+    }
+  while (nread < 0 && errno == EINTR);
+
+  check_partial_read (nread, size);
+
+  return nread;
+}
+
+/* Splice SIZE bytes from the pipe open on IN to OUT.  Return the
+   number of bytes moved, which is less than SIZE only on error.  */
+
+static size_t
+splice_all (int in, int out, size_t size)
+{
+  size_t total_spliced = 0;
+
+  while (total_spliced < size)
+    {
+      process_signals ();
+      ssize_t n = splice (in, NULL, out, NULL, size - total_spliced,
+                          SPLICE_F_MOVE);
+      w_syscalls++;
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          if (n == 0)
+            errno = ENOSPC;
+          break;
+        }
+      total_spliced += n;
+    }
+
+  return total_spliced;
+}
+
+/* Send the SIZE bytes in 'fanout_pipe' to every output, standing in
+   for a write of them with iwrite.  Return the number of bytes written
+   to the first output; diagnose failure to write to another, and
+   quit.  */
+
+static size_t
+splice_output (size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < n_extra_outputs; i++)
+    {
+      ssize_t n;
+      do
+        {
+          process_signals ();
+          n = tee (fanout_pipe[0], fanout_copy[1], size, 0);
+          w_syscalls++;
+        }
+      while (n < 0 && errno == EINTR);
+
+      if (n < 0 || (size_t) n != size
+          || splice_all (fanout_copy[0], extra_output_fds[i], size) != size)
+        {
+          error (0, 0 <= n && (size_t) n != size ? 0 : errno,
+                 _("error writing %s"),
+                 quoteaf (extra_output_files[i]));
+          quit (EXIT_FAILURE);
+        }
+    }
+
+  return splice_all (fanout_pipe[0], STDOUT_FILENO, size);
+}
+#else
+# define start_splice_fanout() false
+# define splice_input(Size) (errno = ENOSYS, -1)
+# define splice_output(Size) ((size_t) 0)
+#endif
+
+/* For status=progress, print the transfer statistics if a second has
+   passed since they were last printed.  */
+
+static void
+print_progress (void)
+{
+  if (status_level == STATUS_PROGRESS)
+    {
+      xtime_t progress_time = gethrxtime ();
+      uintmax_t delta_xtime = progress_time;
+      delta_xtime -= previous_time;
+      double XTIME_PRECISIONe0 = XTIME_PRECISION;
+      if (delta_xtime / XTIME_PRECISIONe0 > 1)
+        {
+          print_xfer_stats (progress_time);
+          previous_time = progress_time;
+        }
+    }
+}
+
+#ifdef __linux__
+/* When a regular file goes to a socket with nothing converted, have
+   the kernel send it straight from the page cache with sendfile,
+   instead of reading it into 'ibuf' and writing it out again.  Start
+   at the current input offset, which skip= has set, and send as much
+   as count= allows.  Every read of a regular file but the last gets
+   a whole block, so the records that reading would have counted
+   follow from the byte total.  Stop at EOF or at the first failure,
+   and leave whatever is left to the read and write loop, which
+   diagnoses any error that persists.  A failure partway through a
+   block leaves bytes that no read or write of a whole record
+   accounts for; count them as bytes only, and have count= allow that
+   much less to the loop.  */
+
+static void
+copy_via_sendfile (void)
+{
+  /* Send at most this much per call, so that progress is reported.  */
+  enum { SENDFILE_MAX = 64 * 1024 * 1024 };
+  struct stat st;
+  uintmax_t remaining = UINTMAX_MAX;
+  uintmax_t total = 0;
+  uintmax_t counted = 0;
+  size_t tail;
+  bool failed = false;
+
+  if ((conversions_mask & (C_TWOBUFS | C_SYNC | C_NOERROR | C_SPARSE))
+      || i_async || i_nocache || o_nocache || latency_target
+      || ((input_flags | output_flags) & O_DIRECT)
+      || input_backend != &posix_io || output_backend != &posix_io
+      || fstat (STDIN_FILENO, &st) != 0 || ! S_ISREG (st.st_mode)
+      || fstat (STDOUT_FILENO, &st) != 0 || ! S_ISSOCK (st.st_mode))
+    return;
+
+  if (max_records != (uintmax_t) -1
+      && max_records <= (UINTMAX_MAX - max_bytes) / input_blocksize)
+    remaining = max_records * input_blocksize + max_bytes;
+
+  while (remaining != 0)
+    {
+      print_progress ();
+      process_signals ();
+      ssize_t n = sendfile (STDOUT_FILENO, STDIN_FILENO, NULL,
+                            MIN (remaining, SENDFILE_MAX));
+      w_syscalls++;
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          failed = n < 0;
+          break;
+        }
+
+      advance_input_offset (n);
+      w_bytes += n;
+      total += n;
+      remaining -= n;
+
+      uintmax_t full = total / input_blocksize;
+      r_full += full - counted;
+      w_full += full - counted;
+      counted = full;
+    }
+
+  tail = total % input_blocksize;
+  if (tail == 0)
+    return;
+  if (! failed)
+    {
+      r_partial++;
+      w_partial++;
+    }
+  else if (max_records != (uintmax_t) -1)
+    {
+      if (tail <= max_bytes)
+        max_bytes -= tail;
+      else
+        {
+          max_records--;
+          max_bytes += input_blocksize - tail;
+        }
+    }
+}
+#else
+# define copy_via_sendfile() ((void) 0)
+#endif
+
+/* Throw away RECORDS blocks of BLOCKSIZE bytes plus BYTES bytes on
+   file descriptor FDESC, which is open with read permission for FILE.
+   Store up to BLOCKSIZE bytes of the data at a time in IBUF or OBUF, if
+   necessary. RECORDS or BYTES must be nonzero. If FDESC is
+   STDIN_FILENO, advance the input offset. Return the number of
+   records remaining, i.e., that were not skipped because EOF was
+   reached.  If FDESC is STDOUT_FILENO, on return, BYTES is the
+   remaining bytes in addition to the remaining records.  */
+
+static uintmax_t
+skip (int fdesc, char const *file, uintmax_t records, size_t blocksize,
+      size_t *bytes)
+{
+  uintmax_t offset = records * blocksize + *bytes;
+
+  /* Try lseek and if an error indicates it was an inappropriate operation --
+     or if the file offset is not representable as an off_t --
+     fall back on using read.  */
+
+  errno = 0;
+  if (records <= OFF_T_MAX / blocksize
+      && 0 <= skip_via_lseek (file, fdesc, offset, SEEK_CUR))
+    {
+      if (fdesc == STDIN_FILENO)
+        {
+           struct stat st;
+           if (input_backend->fstat (STDIN_FILENO, &st) != 0)
+             error (EXIT_FAILURE, errno, _("cannot fstat %s"), quoteaf (file));
+           if (usable_st_size (&st) && st.st_size < input_offset + offset)
+             {
+               /* When skipping past EOF, return the number of _full_ blocks
+                * that are not skipped, and set offset to EOF, so the caller
+                * can determine the requested skip was not satisfied.  */
+               records = ( offset - st.st_size ) / blocksize;
+               offset = st.st_size - input_offset;
+             }
+           else
+             records = 0;
+           advance_input_offset (offset);
+        }
+      else
+        {
+          records = 0;
+          *bytes = 0;
+        }
+      return records;
+    }
+  else
+    {
+      int lseek_errno = errno;
+
+      /* The seek request may have failed above if it was too big
+         (> device size, > max file size, etc.)
+         Or it may not have been done at all (> OFF_T_MAX).
+         Therefore try to seek to the end of the file,
+         to avoid redundant reading.  */
+      if ((skip_via_lseek (file, fdesc, 0, SEEK_END)) >= 0)
+        {
+          /* File is seekable, and we're at the end of it, and
+             size <= OFF_T_MAX. So there's no point using read to advance.  */
+
+          if (!lseek_errno)
+            {
+              /* The original seek was not attempted as offset > OFF_T_MAX.
+                 We should error for write as can't get to the desired
+                 location, even if OFF_T_MAX < max file size.
+                 For read we're not going to read any data anyway,
+                 so we should error for consistency.
+                 It would be nice to not error for /dev/{zero,null}
+                 for any offset, but that's not a significant issue.  */
+              lseek_errno = EOVERFLOW;
+            }
+
+          if (fdesc == STDIN_FILENO)
+            error (0, lseek_errno, _("%s: cannot skip"), quotef (file));
+          else
+            error (0, lseek_errno, _("%s: cannot seek"), quotef (file));
+          /* If the file has a specific size and we've asked
+             to skip/seek beyond the max allowable, then quit.  */
+          quit (EXIT_FAILURE);
+        }
+      /* else file_size && offset > OFF_T_MAX or file ! seekable */
+
+#if defined __linux__ && defined SPLICE_F_MOVE
+      if (fdesc == STDIN_FILENO && input_backend == &posix_io
+          && skip_via_splice (fdesc, file, &records, blocksize, bytes))
+        return records;
+#endif
+
+      char *buf;
+      if (fdesc == STDIN_FILENO)
+        {
+          alloc_ibuf ();
+          buf = ibuf;
+        }
+      else
+        {
+          alloc_obuf ();
+          buf = obuf;
+        }
+
+      do
+        {
+          ssize_t nread = iread_fnc (fdesc, buf, records ? blocksize : *bytes);
+          if (nread < 0)
+            {
+              if (fdesc == STDIN_FILENO)
+                {
+                  error (0, errno, _("error reading %s"), quoteaf (file));
+                  if (conversions_mask & C_NOERROR)
+                    print_stats ();
+                }
+              else
+                error (0, lseek_errno, _("%s: cannot seek"), quotef (file));
+              quit (EXIT_FAILURE);
+            }
+          else if (nread == 0)
+            break;
+          else if (fdesc == STDIN_FILENO)
+            advance_input_offset (nread);
+
+          if (records != 0)
+            records--;
+          else
+            *bytes = 0;
+        }
+      while (records || *bytes);
+
+      return records;
+    }
+}
+
+/* Advance the input by NBYTES if possible, after a read error.
+   The input file offset may or may not have advanced after the failed
+   read; adjust it to point just after the bad record regardless.
+   Return true if successful, or if the input is already known to not
+   be seekable.  */
+
+static bool
+advance_input_after_read_error (size_t nbytes)
+{
+  if (! input_seekable)
+    {
+      if (input_seek_errno == ESPIPE)
+        return true;
+      errno = input_seek_errno;
+    }
+  else
+    {
+      off_t offset;
+      advance_input_offset (nbytes);
+      input_offset_overflow |= (OFF_T_MAX < input_offset);
+      if (input_offset_overflow)
+        {
+          error (0, 0, _("offset overflow while reading file %s"),
+                 quoteaf (input_file));
+          return false;
+        }
+      offset = input_backend->lseek (STDIN_FILENO, 0, SEEK_CUR);
+      if (0 <= offset)
+        {
+          off_t diff;
+          if (offset == input_offset)
+            return true;
+          diff = input_offset - offset;
+          if (! (0 <= diff && diff <= nbytes) && status_level != STATUS_NONE)
+            error (0, 0, _("warning: invalid file offset after failed read"));
+          if (0 <= skip_via_lseek (input_file, STDIN_FILENO, diff, SEEK_CUR))
+            return true;
+          if (errno == 0)
+            error (0, 0, _("cannot work around kernel bug after all"));
+        }
+    }
+
+  error (0, errno, _("%s: cannot seek"), quotef (input_file));
+  return false;
+}
+
+/* Copy NREAD bytes of BUF, with no conversions.  */
+
+static void
+copy_simple (char const *buf, size_t nread)
+{
+  const char *start = buf;	/* First uncopied char in BUF.  */
+
+  /* While nothing is pending in 'obuf', write whole output blocks
+     straight from BUF.  After conv=ucase, swab and the like, which
+     work in place on 'ibuf', this saves a copy when ibs=obs.  Blocks
+     of 'ibuf' may be lent to the output, unless it is on loan from
+     the read-ahead ring, which would reuse it.  */
+  while (oc == 0 && output_blocksize <= nread
+         && (! (output_flags & O_DIRECT)
+             || (uintptr_t) start % page_size == 0))
+    {
+      if (write_block (start, buf == ibuf && ! i_async))
+        ibuf_lent = true;
+      nread -= output_blocksize;
+      start += output_blocksize;
+    }
+
+  while (nread != 0)
+    {
+      size_t nfree = MIN (nread, output_blocksize - oc);
+
+#ifdef __SSE2__
+      if (streaming_stores)
+        stream_copy (obuf + oc, start, nfree);
+      else
+#endif
+        memcpy (obuf + oc, start, nfree);
+
+      nread -= nfree;		/* Update the number of bytes left to copy. */
+      start += nfree;
+      oc += nfree;
+      if (oc >= output_blocksize)
+        write_output ();
+    }
+}
+
+/* Do conv=block on part K of the buffer, from the 'col' recorded for
+   it, into its own output.  */
+
+static void
+block_job (size_t k)
+{
+  struct conv_part *p = &conv_parts[k];
+  size_t col = p->col;
+  size_t i;
+
+  p->out_len = 0;
+  p->truncated = 0;
+  for (i = 0; i < p->len; i++)
+    {
+      if (! part_has_room (p) && ! part_room (p))
+        break;
+      if (p->buf[i] == newline_character)
+        {
+          for (; col < conversion_blocksize; col++)
+            part_char (p, space_character);
+          col = 0;
+        }
+      else
+        {
+          if (col == conversion_blocksize)
+            p->truncated++;
+          else if (col < conversion_blocksize)
+            part_char (p, p->buf[i]);
+          col++;
+        }
+    }
+  p->used = i;
+  p->col = col;
+}
+
+/* Do conv=unblock on part K of the buffer, from the 'col' and
+   'pending_spaces' recorded for it, into its own output.  */
+
+static void
+unblock_job (size_t k)
+{
+  struct conv_part *p = &conv_parts[k];
+  size_t col = p->col;
+  size_t pending = p->pending_spaces;
+  size_t i;
+
+  p->out_len = 0;
+  for (i = 0; i < p->len; i++)
+    {
+      char c = p->buf[i];
+
+      if (! part_has_room (p) && ! part_room (p))
+        break;
+
+      if (col++ >= conversion_blocksize)
+        {
+          col = pending = 0;
+          i--;
+          part_char (p, newline_character);
+        }
+      else if (c == space_character)
+        pending++;
+      else
+        {
+          for (; pending; pending--)
+            part_char (p, space_character);
+          part_char (p, c);
+        }
+    }
+  p->used = i;
+  p->col = col;
+  p->pending_spaces = pending;
+}
+
+/* Copy NREAD bytes of BUF, doing conv=block
+   (pad newline-terminated records to 'conversion_blocksize',
+   replacing the newline with trailing spaces).  */
+
+static void
+copy_with_block (char const *buf, size_t nread)
+{
+  size_t i;
+  size_t nparts = conv_part_count (nread);
+
+  if (1 < nparts)
+    {
+      /* A part starts with the 'col' left by the newline nearest before
+         it, which is quick to find.  */
+      split_conv_parts ((char *) buf, nread, nparts, 1);
+      conv_parts[0].col = col;
+      for (i = 1; i < nparts; i++)
+        {
+          struct conv_part const *prev = &conv_parts[i - 1];
+          char const *nl = memrchr (prev->buf, newline_character, prev->len);
+          conv_parts[i].col = (nl ? (size_t) (prev->buf + prev->len - nl - 1)
+                               : prev->col + prev->len);
+        }
+      run_conv_job (block_job, nparts);
+
+      for (i = 0; i < nparts; i++)
+        {
+          struct conv_part const *p = &conv_parts[i];
+          r_truncate += p->truncated;
+          copy_simple (p->out, p->out_len);
+          col = p->col;
+          if (p->used < p->len)
+            {
+              /* The part ran out of room.  Convert the rest here.  */
+              nread -= p->buf + p->used - buf;
+              buf = p->buf + p->used;
+              break;
+            }
+        }
+      if (i == nparts)
+        return;
+    }
+
+  for (i = nread; i; i--, buf++)
+    {
+      if (*buf == newline_character)
+        {
+          if (col < conversion_blocksize)
+            {
+              size_t j;
+              for (j = col; j < conversion_blocksize; j++)
+                output_char (space_character);
+            }
+          col = 0;
+        }
+      else
+        {
+          if (col == conversion_blocksize)
+            r_truncate++;
+          else if (col < conversion_blocksize)
+            output_char (*buf);
+          col++;
+        }
+    }
+}
+
+/* Copy NREAD bytes of BUF, doing conv=unblock
+   (replace trailing spaces in 'conversion_blocksize'-sized records
+   with a newline).  */
+
+static void
+copy_with_unblock (char const *buf, size_t nread)
+{
+  size_t i;
+  char c;
+  size_t nparts = conv_part_count (nread);
+
+  if (1 < nparts)
+    {
+      split_conv_parts ((char *) buf, nread, nparts, 1);
+      conv_parts[0].col = col;
+      conv_parts[0].pending_spaces = pending_spaces;
+      for (i = 1; i < nparts; i++)
+        {
+          /* Records are fixed length, so 'col' follows from the offset.
+             The pending spaces are those that end the record so far.  */
+          struct conv_part *p = &conv_parts[i];
+          size_t offset = p->buf - buf;
+          size_t n = col + offset;
+          size_t spaces = 0;
+
+          p->col = (n - 1) % conversion_blocksize + 1;
+          while (spaces < MIN (p->col, offset)
+                 && buf[offset - spaces - 1] == space_character)
+            spaces++;
+          if (spaces == offset && spaces < p->col)
+            spaces += pending_spaces;
+          p->pending_spaces = spaces;
+        }
+      run_conv_job (unblock_job, nparts);
+
+      for (i = 0; i < nparts; i++)
+        {
+          struct conv_part const *p = &conv_parts[i];
+          copy_simple (p->out, p->out_len);
+          col = p->col;
+          pending_spaces = p->pending_spaces;
+          if (p->used < p->len)
+            {
+              /* The part ran out of room.  Convert the rest here.  */
+              nread -= p->buf + p->used - buf;
+              buf = p->buf + p->used;
+              break;
+            }
+        }
+      if (i == nparts)
+        return;
+    }
+
+  for (i = 0; i < nread; i++)
+    {
+      c = buf[i];
+
+      if (col++ >= conversion_blocksize)
+        {
+          col = pending_spaces = 0; /* Wipe out any pending spaces.  */
+          i--;			/* Push the char back; get it later. */
+          output_char (newline_character);
+        }
+      else if (c == space_character)
+        pending_spaces++;
+      else
+        {
+          /* 'c' is the character after a run of spaces that were not
+             at the end of the conversion buffer.  Output them.  */
+          while (pending_spaces)
+            {
+              output_char (space_character);
+              --pending_spaces;
+            }
+          output_char (c);
+        }
+    }
+}
+
+/* Set the file descriptor flags for FD that correspond to the nonzero bits
+   in ADD_FLAGS.  The file's name is NAME.  */
+
+static void
+set_fd_flags (int fd, int add_flags, char const *name)
+{
+  /* Ignore file creation flags that are no-ops on file descriptors.  */
+  add_flags &= ~ (O_NOCTTY | O_NOFOLLOW);
+
+  if (add_flags)
+    {
+      int old_flags = fcntl (fd, F_GETFL);
+      int new_flags = old_flags | add_flags;
+      bool ok = true;
+      if (old_flags < 0)
+        ok = false;
+      else if (old_flags != new_flags)
+        {
+          if (new_flags & (O_DIRECTORY | O_NOLINKS))
+            {
+              /* NEW_FLAGS contains at least one file creation flag that
+                 requires some checking of the open file descriptor.  */
+              struct stat st;
+              if (fstat (fd, &st) != 0)
+                ok = false;
+              else if ((new_flags & O_DIRECTORY) && ! S_ISDIR (st.st_mode))
+                {
+                  errno = ENOTDIR;
+                  ok = false;
+                }
+              else if ((new_flags & O_NOLINKS) && 1 < st.st_nlink)
+                {
+                  errno = EMLINK;
+                  ok = false;
+                }
+              new_flags &= ~ (O_DIRECTORY | O_NOLINKS);
+            }
+
+          if (ok && old_flags != new_flags
+              && fcntl (fd, F_SETFL, new_flags) == -1)
+            ok = false;
+        }
+
+      if (!ok)
+        error (EXIT_FAILURE, errno, _("setting flags for %s"), quoteaf (name));
+    }
+}
+
+/* Skip the input as requested by skip=.  */
+
+static void
+skip_input (void)
+{
+  if (skip_records != 0 || skip_bytes != 0)
+    {
+      uintmax_t us_bytes = input_offset + (skip_records * input_blocksize)
+                           + skip_bytes;
+      uintmax_t us_blocks = skip (STDIN_FILENO, input_file,
+                                  skip_records, input_blocksize, &skip_bytes);
+      us_bytes -= input_offset;
+
+      /* POSIX doesn't say what to do when dd detects it has been
+         asked to skip past EOF, so I assume it's non-fatal.
+         There are 3 reasons why there might be unskipped blocks/bytes:
+             1. file is too small
+             2. pipe has not enough data
+             3. partial reads  */
+      if ((us_blocks || (!input_offset_overflow && us_bytes))
+          && status_level != STATUS_NONE)
+        {
+          error (0, 0,
+                 _("%s: cannot skip to specified offset"), quotef (input_file));
+        }
+    }
+}
+
+/* Truncate the output to the offset given by seek=, as POSIX requires
+   unless conv=notrunc.  */
+
+static void
+presize_output (void)
+{
+  uintmax_t size = seek_records * output_blocksize + seek_bytes;
+
+  if (iftruncate (STDOUT_FILENO, size) != 0)
+    {
+      /* Complain only when ftruncate fails on a regular file, a
+         directory, or a shared memory object, as POSIX 1003.1-2004
+         specifies ftruncate's behavior only for these file types.
+         For example, do not complain when Linux kernel 2.4 ftruncate
+         fails on /dev/fd0.  */
+      int ftruncate_errno = errno;
+      struct stat stdout_stat;
+      if (output_backend->fstat (STDOUT_FILENO, &stdout_stat) != 0)
+        error (EXIT_FAILURE, errno, _("cannot fstat %s"),
+               quoteaf (output_file));
+      if (S_ISREG (stdout_stat.st_mode)
+          || S_ISDIR (stdout_stat.st_mode)
+          || S_TYPEISSHM (&stdout_stat))
+        error (EXIT_FAILURE, ftruncate_errno,
+               _("failed to truncate to %"PRIuMAX" bytes"
+                 " in output file %s"),
+               size, quoteaf (output_file));
+    }
+}
+
+/* Reserve space for the output after the seek= offset, as requested
+   by oflag=prealloc.  This is only advice, so ignore failures.  Keep
+   the size, as the output may turn out shorter than expected (e.g.
+   with conv=block).  This may run on a helper thread while the main
+   thread skips the input, so it makes just the one system call, and
+   touches nothing that the main thread changes.  ARG is unused.  */
+
+static void *
+reserve_output (void *arg _GL_UNUSED)
+{
+  output_backend->fallocate (STDOUT_FILENO, FALLOC_FL_KEEP_SIZE,
+                             seek_records * output_blocksize + seek_bytes,
+                             preallocate_size);
+  return NULL;
+}
+
+/* Give back any space that reserve_output reserved past the end of
+   the output file FD, which can turn out shorter than expected.
+   Truncating a file to its own size frees the blocks past its end;
+   punching a hole there does not on all file systems.  This too is
+   only advice.  */
+
+static void
+trim_output (int fd)
+{
+  struct stat st;
+  uintmax_t end = seek_records * output_blocksize + seek_bytes
+                  + preallocate_size;
+
+  if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode)
+      && (uintmax_t) st.st_size < end)
+    ignore_value (ftruncate (fd, st.st_size));
+}
+
+/* Position the output as requested by seek=, writing NULs where it
+   cannot be seeked.  */
+
+static void
+position_output (void)
+{
+  if (seek_records != 0 || seek_bytes != 0)
+    {
+      size_t bytes = seek_bytes;
+      uintmax_t write_records = skip (STDOUT_FILENO, output_file,
+                                      seek_records, output_blocksize, &bytes);
+
+      if (write_records != 0 || bytes != 0)
+        {
+          memset (obuf, 0, write_records ? output_blocksize : bytes);
+
+          do
+            {
+              size_t size = write_records ? output_blocksize : bytes;
+              if (iwrite (STDOUT_FILENO, obuf, size) != size)
+                {
+                  error (0, errno, _("writing to %s"), quoteaf (output_file));
+                  quit (EXIT_FAILURE);
+                }
+
+              if (write_records != 0)
+                write_records--;
+              else
+                bytes = 0;
+            }
+          while (write_records || bytes);
+        }
+    }
+}
+
+/* Return the number of bytes that the copy is expected to write, as
+   far as can be told from count= and the size of the input, or 0 if
+   that is unknown or too large to reserve at the seek= offset.  */
+
+static uintmax_t
+expected_output_size (void)
+{
+  uintmax_t size = UINTMAX_MAX;
+  struct stat st;
+
+  if (max_records != (uintmax_t) -1
+      && max_records <= (UINTMAX_MAX - max_bytes) / input_blocksize)
+    size = max_records * input_blocksize + max_bytes;
+
+  if (input_backend->fstat (STDIN_FILENO, &st) == 0 && usable_st_size (&st))
+    {
+      uintmax_t start = input_offset;
+      if (skip_records <= (UINTMAX_MAX - start - skip_bytes) / input_blocksize)
+        start += skip_records * input_blocksize + skip_bytes;
+      else
+        start = UINTMAX_MAX;
+      size = MIN (size, (start < (uintmax_t) st.st_size
+                         ? st.st_size - start : 0));
+    }
+
+  if (size == UINTMAX_MAX
+      || OFF_T_MAX / output_blocksize < seek_records
+      || OFF_T_MAX - seek_records * output_blocksize - seek_bytes < size)
+    return 0;
+  return size;
+}
+
+/* The number of slots in a buffer ring.  A power of two.  */
+#define RING_SLOTS 32
+
+/* The size of a cache line, or more.  */
+#define CACHE_LINE 64
+
+/* With iflag=async, read ahead into buffers of up to this many bytes
+   in all, though into no fewer than two buffers.  */
+#define READ_AHEAD_MAX (64 * 1024 * 1024)
+
+/* A buffer passed through a ring, with the result of the read into it:
+   LEN bytes, or -1 with errno value ERR.  */
+struct ring_slot
+{
+  char *buf;
+  ssize_t len;
+  int err;
+};
+
+/* A lock-free ring that passes buffers from one producer thread to one
+   consumer thread.  HEAD counts the slots ever pushed and TAIL those
+   ever popped.  Each side writes only its own index, which lives in a
+   cache line of its own along with that side's copy of the other
+   index.  A side rereads the other's index only when its copy says the
+   ring is full or empty, so the two cache lines change hands once per
+   batch of slots rather than once per slot.  A side that has to wait
+   sleeps on the other's index with a futex after setting its flag,
+   and is woken only if the flag is set.  */
+struct buffer_ring
+{
+  struct ring_slot slot[RING_SLOTS];
+
+  alignas (CACHE_LINE) atomic_uint head;
+  unsigned int tail_seen;
+  atomic_bool consumer_waiting;
+
+  alignas (CACHE_LINE) atomic_uint tail;
+  unsigned int head_seen;
+  atomic_bool producer_waiting;
+};
+
+/* Buffers that the reader thread has read into, and buffers that
+   dd_copy is done with.  */
+static struct buffer_ring read_blocks;
+static struct buffer_ring free_blocks;
+
+/* The buffer that dd_copy is working on, if it is from the ring.  */
+static char *async_block;
+
+/* Wait until *INDEX is no longer SEEN.  This may return early.  */
+
+static void
+ring_wait (atomic_uint *index, unsigned int seen)
+{
+#ifdef __linux__
+  syscall (SYS_futex, index, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#else
+  if (atomic_load (index) == seen)
+    sched_yield ();
+#endif
+}
+
+/* Wake the thread waiting on *INDEX.  */
+
+static void
+ring_wake (atomic_uint *index _GL_UNUSED)
+{
+#ifdef __linux__
+  syscall (SYS_futex, index, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+/* Add SLOT to ring R, waiting while R is full.  */
+
+static void
+ring_push (struct buffer_ring *r, struct ring_slot slot)
+{
+  unsigned int head = atomic_load_explicit (&r->head, memory_order_relaxed);
+
+  if (head - r->tail_seen == RING_SLOTS)
+    {
+      r->tail_seen = atomic_load_explicit (&r->tail, memory_order_acquire);
+      while (head - r->tail_seen == RING_SLOTS)
+        {
+          atomic_store (&r->producer_waiting, true);
+          r->tail_seen = atomic_load (&r->tail);
+          if (head - r->tail_seen == RING_SLOTS)
+            ring_wait (&r->tail, r->tail_seen);
+          atomic_store_explicit (&r->producer_waiting, false,
+                                 memory_order_relaxed);
+          r->tail_seen = atomic_load_explicit (&r->tail,
+                                               memory_order_acquire);
+        }
+    }
+
+  r->slot[head % RING_SLOTS] = slot;
+  atomic_store (&r->head, head + 1);
+  if (atomic_load (&r->consumer_waiting))
+    ring_wake (&r->head);
+}
+
+/* Remove and return the oldest slot of ring R, waiting while R is
+   empty.  */
+
+static struct ring_slot
+ring_pop (struct buffer_ring *r)
+{
+  unsigned int tail = atomic_load_explicit (&r->tail, memory_order_relaxed);
+  struct ring_slot slot;
+
+  if (tail == r->head_seen)
+    {
+      r->head_seen = atomic_load_explicit (&r->head, memory_order_acquire);
+      while (tail == r->head_seen)
+        {
+          atomic_store (&r->consumer_waiting, true);
+          r->head_seen = atomic_load (&r->head);
+          if (tail == r->head_seen)
+            ring_wait (&r->head, r->head_seen);
+          atomic_store_explicit (&r->consumer_waiting, false,
+                                 memory_order_relaxed);
+          r->head_seen = atomic_load_explicit (&r->head,
+                                               memory_order_acquire);
+        }
+    }
+
+  slot = r->slot[tail % RING_SLOTS];
+  atomic_store (&r->tail, tail + 1);
+  if (atomic_load (&r->producer_waiting))
+    ring_wake (&r->tail);
+  return slot;
+}
+
+/* The reader thread for iflag=async: read blocks as dd_copy would,
+   into buffers from 'free_blocks', and pass them on through
+   'read_blocks'.  Stop after passing on EOF, an error, or the
+   block that reaches count=.  */
+
+static void *
+read_ahead (void *arg _GL_UNUSED)
+{
+  uintmax_t reads = 0;
+
+  while (true)
+    {
+      struct ring_slot block = ring_pop (&free_blocks);
+
+      if (reads >= max_records + !!max_bytes)
+        {
+          block.len = 0;
+          ring_push (&read_blocks, block);
+          break;
+        }
+
+      block.len = iread_fnc (STDIN_FILENO, block.buf,
+                             reads < max_records ? input_blocksize : max_bytes);
+      block.err = errno;
+      ring_push (&read_blocks, block);
+      if (block.len <= 0)
+        break;
+      reads++;
+    }
+
+  return NULL;
+}
+
+/* Allocate the buffers to read ahead into, reusing 'ibuf' as one, and
+   start the reader thread.  Return true if successful.  */
+
+static bool
+start_read_ahead (void)
+{
+  size_t nblocks = MAX (2, MIN (RING_SLOTS,
+                                READ_AHEAD_MAX / input_blocksize));
+  size_t i;
+  pthread_t thread;
+
+  ring_push (&free_blocks, (struct ring_slot) { .buf = ibuf });
+  for (i = 1; i < nblocks; i++)
+    {
+      char *buf = buffer_get (input_blocksize);
+      if (!buf)
+        break;
+      ring_push (&free_blocks, (struct ring_slot) { .buf = buf });
+    }
+  if (i < 2 || ! start_thread (&thread, read_ahead, NULL))
+    return false;
+  pthread_detach (thread);
+  return true;
+}
+
+/* Return the next block that the reader thread read, and give it back
+   the one before.  Set errno if the read failed.  */
+
+static ssize_t
+take_read_block (void)
+{
+  struct ring_slot block;
+
+  if (async_block)
+    ring_push (&free_blocks, (struct ring_slot) { .buf = async_block });
+  block = ring_pop (&read_blocks);
+  async_block = block.buf;
+  errno = block.err;
+  return block.len;
+}
+
+/* Finish the output once the copy is over: write out whatever the
+   backend still holds, extend the output over a final seek, give back
+   unused reservations, and synchronize as requested.  EXIT_STATUS is
+   the status of the copy so far; return the updated status.  */
+
+static int
+finish_output (int exit_status)
+{
+  if (output_backend->finish (STDOUT_FILENO) != 0)
+    {
+      error (0, errno, _("error writing %s"), quoteaf (output_file));
+      return EXIT_FAILURE;
+    }
+
+  /* If the last write was converted to a seek, then for a regular file
+     or shared memory object, ftruncate to extend the size.  */
+  if (final_op_was_seek)
+    {
+      struct stat stdout_stat;
+      if (output_backend->fstat (STDOUT_FILENO, &stdout_stat) != 0)
+        {
+          error (0, errno, _("cannot fstat %s"), quoteaf (output_file));
+          return EXIT_FAILURE;
+        }
+      if (S_ISREG (stdout_stat.st_mode) || S_TYPEISSHM (&stdout_stat))
+        {
+          off_t output_offset = output_backend->lseek (STDOUT_FILENO, 0,
+                                                       SEEK_CUR);
+          if (0 <= output_offset && stdout_stat.st_size < output_offset)
+            {
+              if (iftruncate (STDOUT_FILENO, output_offset) != 0)
+                {
+                  error (0, errno,
+                         _("failed to truncate to %" PRIdMAX " bytes"
+                           " in output file %s"),
+                         (intmax_t) output_offset, quoteaf (output_file));
+                  return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+  if (preallocate_size)
+    {
+      size_t i;
+      trim_output (STDOUT_FILENO);
+      for (i = 0; i < n_extra_outputs; i++)
+        trim_output (extra_output_fds[i]);
+    }
+
+  if ((conversions_mask & C_FDATASYNC)
+      && output_backend->fdatasync (STDOUT_FILENO) != 0)
+    {
+      if (errno != ENOSYS && errno != EINVAL)
+        {
+          error (0, errno, _("fdatasync failed for %s"), quoteaf (output_file));
+          exit_status = EXIT_FAILURE;
+        }
+      conversions_mask |= C_FSYNC;
+    }
+
+  if (conversions_mask & C_FSYNC)
+    while (output_backend->fsync (STDOUT_FILENO) != 0)
+      if (errno != EINTR)
+        {
+          error (0, errno, _("fsync failed for %s"), quoteaf (output_file));
+          return EXIT_FAILURE;
+        }
+
+  return exit_status;
+}
+
+/* The main loop.  */
+
+static int
+dd_copy (void)
+{
+  char *bufstart;		/* Input buffer. */
+  ssize_t nread;		/* Bytes read in the current block.  */
+
+  /* If nonzero, then the previously read block was partial and
+     PARTREAD was its size.  */
+  size_t partread = 0;
+
+  int exit_status = EXIT_SUCCESS;
+  size_t n_bytes_read;
+
+  /* Where the current block is read to.  */
+  char *rbuf;
+
+  /* Leave at least one extra byte at the beginning and end of 'ibuf'
+     for conv=swab, but keep the buffer address even.  But some peculiar
+     device drivers work only with word-aligned buffers, so leave an
+     extra two bytes.  */
+
+  /* Some devices require alignment on a sector or page boundary
+     (e.g. character disk devices).  Align the input buffer to a
+     page boundary to cover all bases.  Note that due to the swab
+     algorithm, we must have at least one byte in the page before
+     the input buffer;  thus we allocate 2 pages of slop in the
+     real buffer.  8k above the blocksize shouldn't bother anyone.
+
+     The page alignment is necessary on any Linux kernel that supports
+     either the SGI raw I/O patch or Steven Tweedies raw I/O patch.
+     It is necessary when accessing raw (i.e., character special) disk
+     devices on Unixware or other SVR4-derived system.  */
+
+  /* Truncate before anything can fail, so that a failure to skip
+     leaves the output truncated as POSIX requires.  */
+  if (truncate_output)
+    presize_output ();
+
+  /* Skipping input (e.g. from a tape) and reserving space for the
+     output can each take a long time, so overlap them.  Positioning
+     the output reads and writes it through the same buffers, counters
+     and backends as skipping the input, so it waits until that is
+     done; it is a plain lseek but for outputs that cannot seek.  */
+  bool overlapped = false;
+  pthread_t reserver;
+
+  if (preallocate_size)
+    {
+      if (skip_records != 0 || skip_bytes != 0)
+        overlapped = start_thread (&reserver, reserve_output, NULL);
+      if (! overlapped)
+        reserve_output (NULL);
+    }
+
+  skip_input ();
+
+  if (overlapped)
+    pthread_join (reserver, NULL);
+
+  position_output ();
+
+  if (max_records == 0 && max_bytes == 0)
+    return finish_output (exit_status);
+
+  alloc_ibuf ();
+  alloc_obuf ();
+
+  if (i_async && ! start_read_ahead ())
+    error (EXIT_FAILURE, 0, _("failed to start reading %s ahead"),
+           quoteaf (input_file));
+
+  /* Without conversions, a separate output buffer is there only to
+     reblock, so read straight into it wherever a whole input block
+     fits, instead of copying it over from IBUF afterwards.  When OBS
+     is a multiple of IBS, that is every full block.  */
+  bool reblock_in_place = ((conversions_mask & C_TWOBUFS)
+                           && ! translation_needed
+                           && ! (conversions_mask
+                                 & (C_SWAB | C_BLOCK | C_UNBLOCK)));
+
+  /* Without conversions, several outputs can be fed by splice and tee
+     instead of reading and writing the data.  */
+  bool splicing = start_splice_fanout ();
+
+  /* From a regular file to a socket, the kernel can do the copy.  */
+  copy_via_sendfile ();
+
+  while (1)
+    {
+      print_progress ();
+
+      if (r_partial + r_full >= max_records + !!max_bytes)
+        break;
+
+      if (i_async)
+        {
+          /* The block has been read into a buffer of its own, which
+             stands in for IBUF, and for OBUF if they are the same.  */
+          nread = take_read_block ();
+          if (obuf == ibuf)
+            obuf = async_block;
+          rbuf = ibuf = async_block;
+        }
+      else
+        {
+          /* Read into the output buffer if a whole block fits there
+             and, for direct I/O, it is as aligned as IBUF.  */
+          if (ibuf_lent)
+            {
+              replace_lent (&ibuf, input_blocksize);
+              ibuf_lent = false;
+            }
+          rbuf = ibuf;
+          if (reblock_in_place && input_blocksize <= output_blocksize - oc
+              && (! (input_flags & O_DIRECT) || oc % page_size == 0))
+            rbuf = obuf + oc;
+
+          /* Zero the buffer before reading, so that if we get a read
+             error, whatever data we are able to read is followed by
+             zeros.  This minimizes data loss. */
+          if ((conversions_mask & C_SYNC) && (conversions_mask & C_NOERROR))
+            memset (rbuf,
+                    (conversions_mask & (C_BLOCK | C_UNBLOCK)) ? ' ' : '\0',
+                    input_blocksize);
+
+          size_t size = (r_partial + r_full >= max_records
+                         ? max_bytes : input_blocksize);
+          nread = (splicing
+                   ? splice_input (size)
+                   : iread_fnc (STDIN_FILENO, rbuf, size));
+        }
+
+      if (nread >= 0 && i_nocache)
+        invalidate_cache (STDIN_FILENO, nread);
+
+      if (nread == 0)
+        break;			/* EOF.  */
+
+      if (nread < 0)
+        {
+          if (!(conversions_mask & C_NOERROR) || status_level != STATUS_NONE)
+            error (0, errno, _("error reading %s"), quoteaf (input_file));
+
+          if (conversions_mask & C_NOERROR)
+            {
+              print_stats ();
+              size_t bad_portion = input_blocksize - partread;
+
+              /* We already know this data is not cached,
+                 but call this so that correct offsets are maintained.  */
+              invalidate_cache (STDIN_FILENO, bad_portion);
+
+              /* Seek past the bad block if possible. */
+              if (!advance_input_after_read_error (bad_portion))
+                {
+                  exit_status = EXIT_FAILURE;
+
+                  /* Suppress duplicate diagnostics.  */
+                  input_seekable = false;
+                  input_seek_errno = ESPIPE;
+                }
+              if ((conversions_mask & C_SYNC) && !partread)
+                /* Replace the missing input with null bytes and
+                   proceed normally.  */
+                nread = 0;
+              else
+                continue;
+            }
+          else
+            {
+              /* Write any partial block. */
+              exit_status = EXIT_FAILURE;
+              break;
+            }
+        }
+
+      n_bytes_read = nread;
+      advance_input_offset (nread);
+
+      if (n_bytes_read < input_blocksize)
+        {
+          r_partial++;
+          partread = n_bytes_read;
+          if (conversions_mask & C_SYNC)
+            {
+              if (!(conversions_mask & C_NOERROR))
+                /* If C_NOERROR, we zeroed the block before reading. */
+                memset (rbuf + n_bytes_read,
+                        (conversions_mask & (C_BLOCK | C_UNBLOCK)) ? ' ' : '\0',
+                        input_blocksize - n_bytes_read);
+              n_bytes_read = input_blocksize;
+            }
+        }
+      else
+        {
+          r_full++;
+          partread = 0;
+        }
+
+      if (ibuf == obuf)		/* If not C_TWOBUFS. */
+        {
+          bool lent = false;
+          size_t nwritten = (splicing
+                             ? splice_output (n_bytes_read)
+                             : ! i_async
+                             ? write_lent (obuf, n_bytes_read, &lent)
+                             : iwrite (STDOUT_FILENO, obuf, n_bytes_read));
+          if (lent)
+            {
+              replace_lent (&ibuf, input_blocksize);
+              obuf = ibuf;
+            }
+          w_bytes += nwritten;
+          if (nwritten != n_bytes_read)
+            {
+              error (0, errno, _("error writing %s"), quoteaf (output_file));
+              return EXIT_FAILURE;
+            }
+          else if (n_bytes_read == input_blocksize)
+            w_full++;
+          else
+            w_partial++;
+          continue;
+        }
+
+      if (rbuf != ibuf)
+        {
+          /* The block is already in place in the output buffer.  */
+          oc += n_bytes_read;
+          if (oc >= output_blocksize)
+            write_output ();
+          continue;
+        }
+
+      /* Do any translations on the whole buffer at once.  */
+
+      if (translation_needed)
+        translate_buffer (ibuf, n_bytes_read);
+
+      if (conversions_mask & C_SWAB)
+        bufstart = swab_buffer (ibuf, &n_bytes_read);
+      else
+        bufstart = ibuf;
+
+      if (conversions_mask & C_BLOCK)
+        copy_with_block (bufstart, n_bytes_read);
+      else if (conversions_mask & C_UNBLOCK)
+        copy_with_unblock (bufstart, n_bytes_read);
+      else
+        copy_simple (bufstart, n_bytes_read);
+    }
+
+  /* If we have a char left as a result of conv=swab, output it.  */
+  if (char_is_saved)
+    {
+      if (conversions_mask & C_BLOCK)
+        copy_with_block (&saved_char, 1);
+      else if (conversions_mask & C_UNBLOCK)
+        copy_with_unblock (&saved_char, 1);
+      else
+        output_char (saved_char);
+    }
+
+  if ((conversions_mask & C_BLOCK) && col > 0)
+    {
+      /* If the final input line didn't end with a '\n', pad
+         the output block to 'conversion_blocksize' chars.  */
+      size_t i;
+      for (i = col; i < conversion_blocksize; i++)
+        output_char (space_character);
+    }
+
+  if (col && (conversions_mask & C_UNBLOCK))
+    {
+      /* If there was any output, add a final '\n'.  */
+      output_char (newline_character);
+    }
+
+  /* Write out the last block. */
+  if (oc != 0)
+    {
+      size_t nwritten = iwrite (STDOUT_FILENO, obuf, oc);
+      w_bytes += nwritten;
+      if (nwritten != 0)
+        w_partial++;
+      if (nwritten != oc)
+        {
+          error (0, errno, _("error writing %s"), quoteaf (output_file));
+          return EXIT_FAILURE;
+        }
+    }
+
+  return finish_output (exit_status);
+}
+
+#ifdef DD_FAULT_INJECTION
+
+/* For testing, the copy loop and conversions as they were before any
+   of them were made faster: one block at a time, a byte at a time,
+   with no threads, read-ahead, splicing or lending of buffers.  Run
+   with DD_REFERENCE set, its output and its record counts must match
+   those of dd_copy for the same operands, input and DD_SHORT_READS.  */
+
+/* Write, then empty, the output buffer 'obuf'.  */
+
+static void
+ref_write_output (void)
+{
+  size_t nwritten = iwrite (STDOUT_FILENO, obuf, output_blocksize);
+  w_bytes += nwritten;
+  if (nwritten != output_blocksize)
+    {
+      error (0, errno, _("writing to %s"), quoteaf (output_file));
+      if (nwritten != 0)
+        w_partial++;
+      quit (EXIT_FAILURE);
+    }
+  else
+    w_full++;
+  oc = 0;
+}
+
+/* Output character C.  */
+
+static void
+ref_output_char (char c)
+{
+  obuf[oc++] = c;
+  if (oc >= output_blocksize)
+    ref_write_output ();
+}
+
+/* Apply the character-set translations specified by the user
+   to the NREAD bytes in BUF.  */
+
+static void
+ref_translate_buffer (char *buf, size_t nread)
+{
+  char *cp;
+  size_t i;
+
+  for (i = nread, cp = buf; i; i--, cp++)
+    *cp = trans_table[to_uchar (*cp)];
+}
+
+/* Swap NREAD bytes in BUF, plus possibly an initial char from the
+   previous call.  If NREAD is odd, save the last char for the
+   next call.   Return the new start of the BUF buffer.  */
+
+static char *
+ref_swab_buffer (char *buf, size_t *nread)
+{
+  char *bufstart = buf;
+  char *cp;
+  size_t i;
+
+  /* Is a char left from last time?  */
+  if (char_is_saved)
     {
-      if (input_seek_errno == ESPIPE)
-        return true;
-      errno = input_seek_errno;
+      *--bufstart = saved_char;
+      (*nread)++;
+      char_is_saved = false;
     }
-  else
+
+  if (*nread & 1)
     {
-      off_t offset;
-      advance_input_offset (nbytes);
-      input_offset_overflow |= (OFF_T_MAX < input_offset);
-      if (input_offset_overflow)
-        {
-          error (0, 0, _("offset overflow while reading file %s"),
-                 quoteaf (input_file));
-          return false;
-        }
-      offset = lseek (STDIN_FILENO, 0, SEEK_CUR);
-      if (0 <= offset)
-        {
-          off_t diff;
-          if (offset == input_offset)
-            return true;
-          diff = input_offset - offset;
-          if (! (0 <= diff && diff <= nbytes) && status_level != STATUS_NONE)
-            error (0, 0, _("warning: invalid file offset after failed read"));
-          if (0 <= skip_via_lseek (input_file, STDIN_FILENO, diff, SEEK_CUR))
-            return true;
-          if (errno == 0)
-            error (0, 0, _("cannot work around kernel bug after all"));
-        }
+      /* An odd number of chars are in the buffer.  */
+      saved_char = bufstart[--*nread];
+      char_is_saved = true;
     }
 
-  error (0, errno, _("%s: cannot seek"), quotef (input_file));
-  return false;
+  /* Do the byte-swapping by moving every second character two
+     positions toward the end, working from the end of the buffer
+     toward the beginning.  This way we only move half of the data.  */
+
+  cp = bufstart + *nread;	/* Start one char past the last.  */
+  for (i = *nread / 2; i; i--, cp -= 2)
+    *cp = *(cp - 2);
+
+  return ++bufstart;
 }
 
 /* Copy NREAD bytes of BUF, with no conversions.  */
 
 static void
-copy_simple (char const *buf, size_t nread)
+ref_copy_simple (char const *buf, size_t nread)
 {
   const char *start = buf;	/* First uncopied char in BUF.  */
 
@@ -1881,7 +6840,7 @@ copy_simple (char const *buf, size_t nread)
       start += nfree;
       oc += nfree;
       if (oc >= output_blocksize)
-        write_output ();
+        ref_write_output ();
     }
   while (nread != 0);
 }
@@ -1891,7 +6850,7 @@ copy_simple (char const *buf, size_t nread)
    replacing the newline with trailing spaces).  */
 
 static void
-copy_with_block (char const *buf, size_t nread)
+ref_copy_with_block (char const *buf, size_t nread)
 {
   size_t i;
 
@@ -1903,7 +6862,7 @@ copy_with_block (char const *buf, size_t nread)
             {
               size_t j;
               for (j = col; j < conversion_blocksize; j++)
-                output_char (space_character);
+                ref_output_char (space_character);
             }
           col = 0;
         }
@@ -1912,7 +6871,7 @@ copy_with_block (char const *buf, size_t nread)
           if (col == conversion_blocksize)
             r_truncate++;
           else if (col < conversion_blocksize)
-            output_char (*buf);
+            ref_output_char (*buf);
           col++;
         }
     }
@@ -1923,11 +6882,10 @@ copy_with_block (char const *buf, size_t nread)
    with a newline).  */
 
 static void
-copy_with_unblock (char const *buf, size_t nread)
+ref_copy_with_unblock (char const *buf, size_t nread)
 {
   size_t i;
   char c;
-  static size_t pending_spaces = 0;
 
   for (i = 0; i < nread; i++)
     {
@@ -1937,7 +6895,7 @@ copy_with_unblock (char const *buf, size_t nread)
         {
           col = pending_spaces = 0; /* Wipe out any pending spaces.  */
           i--;			/* Push the char back; get it later. */
-          output_char (newline_character);
+          ref_output_char (newline_character);
         }
       else if (c == space_character)
         pending_spaces++;
@@ -1947,66 +6905,18 @@ copy_with_unblock (char const *buf, size_t nread)
              at the end of the conversion buffer.  Output them.  */
           while (pending_spaces)
             {
-              output_char (space_character);
+              ref_output_char (space_character);
               --pending_spaces;
             }
-          output_char (c);
-        }
-    }
-}
-
-/* Set the file descriptor flags for FD that correspond to the nonzero bits
-   in ADD_FLAGS.  The file's name is NAME.  */
-
-static void
-set_fd_flags (int fd, int add_flags, char const *name)
-{
-  /* Ignore file creation flags that are no-ops on file descriptors.  */
-  add_flags &= ~ (O_NOCTTY | O_NOFOLLOW);
-
-  if (add_flags)
-    {
-      int old_flags = fcntl (fd, F_GETFL);
-      int new_flags = old_flags | add_flags;
-      bool ok = true;
-      if (old_flags < 0)
-        ok = false;
-      else if (old_flags != new_flags)
-        {
-          if (new_flags & (O_DIRECTORY | O_NOLINKS))
-            {
-              /* NEW_FLAGS contains at least one file creation flag that
-                 requires some checking of the open file descriptor.  */
-              struct stat st;
-              if (fstat (fd, &st) != 0)
-                ok = false;
-              else if ((new_flags & O_DIRECTORY) && ! S_ISDIR (st.st_mode))
-                {
-                  errno = ENOTDIR;
-                  ok = false;
-                }
-              else if ((new_flags & O_NOLINKS) && 1 < st.st_nlink)
-                {
-                  errno = EMLINK;
-                  ok = false;
-                }
-              new_flags &= ~ (O_DIRECTORY | O_NOLINKS);
-            }
-
-          if (ok && old_flags != new_flags
-              && fcntl (fd, F_SETFL, new_flags) == -1)
-            ok = false;
+          ref_output_char (c);
         }
-
-      if (!ok)
-        error (EXIT_FAILURE, errno, _("setting flags for %s"), quoteaf (name));
     }
 }
 
-/* The main loop.  */
+/* The main loop, as a reference for dd_copy.  */
 
 static int
-dd_copy (void)
+reference_copy (void)
 {
   char *bufstart;		/* Input buffer. */
   ssize_t nread;		/* Bytes read in the current block.  */
@@ -2018,93 +6928,22 @@ dd_copy (void)
   int exit_status = EXIT_SUCCESS;
   size_t n_bytes_read;
 
-  /* Leave at least one extra byte at the beginning and end of 'ibuf'
-     for conv=swab, but keep the buffer address even.  But some peculiar
-     device drivers work only with word-aligned buffers, so leave an
-     extra two bytes.  */
-
-  /* Some devices require alignment on a sector or page boundary
-     (e.g. character disk devices).  Align the input buffer to a
-     page boundary to cover all bases.  Note that due to the swab
-     algorithm, we must have at least one byte in the page before
-     the input buffer;  thus we allocate 2 pages of slop in the
-     real buffer.  8k above the blocksize shouldn't bother anyone.
-
-     The page alignment is necessary on any Linux kernel that supports
-     either the SGI raw I/O patch or Steven Tweedies raw I/O patch.
-     It is necessary when accessing raw (i.e., character special) disk
-     devices on Unixware or other SVR4-derived system.  */
-
-  if (skip_records != 0 || skip_bytes != 0)
-    {
-      uintmax_t us_bytes = input_offset + (skip_records * input_blocksize)
-                           + skip_bytes;
-      uintmax_t us_blocks = skip (STDIN_FILENO, input_file,
-                                  skip_records, input_blocksize, &skip_bytes);
-      us_bytes -= input_offset;
-
-      /* POSIX doesn't say what to do when dd detects it has been
-         asked to skip past EOF, so I assume it's non-fatal.
-         There are 3 reasons why there might be unskipped blocks/bytes:
-             1. file is too small
-             2. pipe has not enough data
-             3. partial reads  */
-      if ((us_blocks || (!input_offset_overflow && us_bytes))
-          && status_level != STATUS_NONE)
-        {
-          error (0, 0,
-                 _("%s: cannot skip to specified offset"), quotef (input_file));
-        }
-    }
-
-  if (seek_records != 0 || seek_bytes != 0)
-    {
-      size_t bytes = seek_bytes;
-      uintmax_t write_records = skip (STDOUT_FILENO, output_file,
-                                      seek_records, output_blocksize, &bytes);
-
-      if (write_records != 0 || bytes != 0)
-        {
-          memset (obuf, 0, write_records ? output_blocksize : bytes);
-
-          do
-            {
-              size_t size = write_records ? output_blocksize : bytes;
-              if (iwrite (STDOUT_FILENO, obuf, size) != size)
-                {
-                  error (0, errno, _("writing to %s"), quoteaf (output_file));
-                  quit (EXIT_FAILURE);
-                }
-
-              if (write_records != 0)
-                write_records--;
-              else
-                bytes = 0;
-            }
-          while (write_records || bytes);
-        }
-    }
+  if (truncate_output)
+    presize_output ();
+  if (preallocate_size)
+    reserve_output (NULL);
+  skip_input ();
+  position_output ();
 
   if (max_records == 0 && max_bytes == 0)
-    return exit_status;
+    return finish_output (exit_status);
 
   alloc_ibuf ();
   alloc_obuf ();
 
   while (1)
     {
-      if (status_level == STATUS_PROGRESS)
-        {
-          xtime_t progress_time = gethrxtime ();
-          uintmax_t delta_xtime = progress_time;
-          delta_xtime -= previous_time;
-          double XTIME_PRECISIONe0 = XTIME_PRECISION;
-          if (delta_xtime / XTIME_PRECISIONe0 > 1)
-            {
-              print_xfer_stats (progress_time);
-              previous_time = progress_time;
-            }
-        }
+      print_progress ();
 
       if (r_partial + r_full >= max_records + !!max_bytes)
         break;
@@ -2208,30 +7047,30 @@ dd_copy (void)
       /* Do any translations on the whole buffer at once.  */
 
       if (translation_needed)
-        translate_buffer (ibuf, n_bytes_read);
+        ref_translate_buffer (ibuf, n_bytes_read);
 
       if (conversions_mask & C_SWAB)
-        bufstart = swab_buffer (ibuf, &n_bytes_read);
+        bufstart = ref_swab_buffer (ibuf, &n_bytes_read);
       else
         bufstart = ibuf;
 
       if (conversions_mask & C_BLOCK)
-        copy_with_block (bufstart, n_bytes_read);
+        ref_copy_with_block (bufstart, n_bytes_read);
       else if (conversions_mask & C_UNBLOCK)
-        copy_with_unblock (bufstart, n_bytes_read);
+        ref_copy_with_unblock (bufstart, n_bytes_read);
       else
-        copy_simple (bufstart, n_bytes_read);
+        ref_copy_simple (bufstart, n_bytes_read);
     }
 
   /* If we have a char left as a result of conv=swab, output it.  */
   if (char_is_saved)
     {
       if (conversions_mask & C_BLOCK)
-        copy_with_block (&saved_char, 1);
+        ref_copy_with_block (&saved_char, 1);
       else if (conversions_mask & C_UNBLOCK)
-        copy_with_unblock (&saved_char, 1);
+        ref_copy_with_unblock (&saved_char, 1);
       else
-        output_char (saved_char);
+        ref_output_char (saved_char);
     }
 
   if ((conversions_mask & C_BLOCK) && col > 0)
@@ -2240,13 +7079,13 @@ dd_copy (void)
          the output block to 'conversion_blocksize' chars.  */
       size_t i;
       for (i = col; i < conversion_blocksize; i++)
-        output_char (space_character);
+        ref_output_char (space_character);
     }
 
   if (col && (conversions_mask & C_UNBLOCK))
     {
       /* If there was any output, add a final '\n'.  */
-      output_char (newline_character);
+      ref_output_char (newline_character);
     }
 
   /* Write out the last block. */
@@ -2263,53 +7102,9 @@ dd_copy (void)
         }
     }
 
-  /* If the last write was converted to a seek, then for a regular file
-     or shared memory object, ftruncate to extend the size.  */
-  if (final_op_was_seek)
-    {
-      struct stat stdout_stat;
-      if (fstat (STDOUT_FILENO, &stdout_stat) != 0)
-        {
-          error (0, errno, _("cannot fstat %s"), quoteaf (output_file));
-          return EXIT_FAILURE;
-        }
-      if (S_ISREG (stdout_stat.st_mode) || S_TYPEISSHM (&stdout_stat))
-        {
-          off_t output_offset = lseek (STDOUT_FILENO, 0, SEEK_CUR);
-          if (0 <= output_offset && stdout_stat.st_size < output_offset)
-            {
-              if (iftruncate (STDOUT_FILENO, output_offset) != 0)
-                {
-                  error (0, errno,
-                         _("failed to truncate to %" PRIdMAX " bytes"
-                           " in output file %s"),
-                         (intmax_t) output_offset, quoteaf (output_file));
-                  return EXIT_FAILURE;
-                }
-            }
-        }
-    }
-
-  if ((conversions_mask & C_FDATASYNC) && fdatasync (STDOUT_FILENO) != 0)
-    {
-      if (errno != ENOSYS && errno != EINVAL)
-        {
-          error (0, errno, _("fdatasync failed for %s"), quoteaf (output_file));
-          exit_status = EXIT_FAILURE;
-        }
-      conversions_mask |= C_FSYNC;
-    }
-
-  if (conversions_mask & C_FSYNC)
-    while (fsync (STDOUT_FILENO) != 0)
-      if (errno != EINTR)
-        {
-          error (0, errno, _("fsync failed for %s"), quoteaf (output_file));
-          return EXIT_FAILURE;
-        }
-
-  return exit_status;
+  return finish_output (exit_status);
 }
+#endif
 
 int
 main (int argc, char **argv)
@@ -2318,6 +7113,7 @@ main (int argc, char **argv)
   int exit_status;
   off_t offset;
 
+  main_thread = pthread_self ();
   install_signal_handlers ();
 
   initialize_main (&argc, &argv);
@@ -2345,13 +7141,33 @@ main (int argc, char **argv)
   /* Decode arguments. */
   scanargs (argc, argv);
 
+#ifdef DD_FAULT_INJECTION
+  parse_faults (getenv ("DD_FAULTS"), getenv ("DD_SHORT_READS"));
+  use_reference_copy = !! getenv ("DD_REFERENCE");
+#endif
+
   apply_translations ();
 
+#ifdef __SSE2__
+  {
+    size_t cache_size = last_level_cache_size ();
+    streaming_stores = cache_size && cache_size < output_blocksize;
+  }
+#endif
+
+  if (ioprio_class)
+    set_io_priority ();
+
   if (input_file == NULL)
     {
       input_file = _("standard input");
       set_fd_flags (STDIN_FILENO, input_flags, input_file);
     }
+  else if (i_socket)
+    {
+      open_socket (STDIN_FILENO, input_file, true);
+      set_fd_flags (STDIN_FILENO, input_flags, input_file);
+    }
   else
     {
       if (ifd_reopen (STDIN_FILENO, input_file, O_RDONLY | input_flags, 0) < 0)
@@ -2359,7 +7175,8 @@ main (int argc, char **argv)
                quoteaf (input_file));
     }
 
-  offset = lseek (STDIN_FILENO, 0, SEEK_CUR);
+  input_backend = select_backend (STDIN_FILENO);
+  offset = input_backend->lseek (STDIN_FILENO, 0, SEEK_CUR);
   input_seekable = (0 <= offset);
   input_offset = MAX (0, offset);
   input_seek_errno = errno;
@@ -2368,10 +7185,12 @@ main (int argc, char **argv)
     {
       output_file = _("standard output");
       set_fd_flags (STDOUT_FILENO, output_flags, output_file);
+      output_backend = select_backend (STDOUT_FILENO);
     }
   else
     {
       mode_t perms = MODE_RW_UGO;
+      size_t j;
       int opts
         = (output_flags
            | (conversions_mask & C_NOCREAT ? 0 : O_CREAT)
@@ -2381,16 +7200,21 @@ main (int argc, char **argv)
       /* Open the output file with *read* access only if we might
          need to read to satisfy a 'seek=' request.  If we can't read
          the file, go ahead with write-only access; it might work.  */
-      if ((! seek_records
-           || ifd_reopen (STDOUT_FILENO, output_file, O_RDWR | opts, perms) < 0)
-          && (ifd_reopen (STDOUT_FILENO, output_file, O_WRONLY | opts, perms)
-              < 0))
+      if (o_socket)
+        {
+          open_socket (STDOUT_FILENO, output_file, false);
+          set_fd_flags (STDOUT_FILENO, output_flags, output_file);
+        }
+      else if ((! seek_records
+                || ifd_reopen (STDOUT_FILENO, output_file, O_RDWR | opts,
+                               perms) < 0)
+               && (ifd_reopen (STDOUT_FILENO, output_file, O_WRONLY | opts,
+                               perms) < 0))
         error (EXIT_FAILURE, errno, _("failed to open %s"),
                quoteaf (output_file));
 
       if (seek_records != 0 && !(conversions_mask & C_NOTRUNC))
         {
-          uintmax_t size = seek_records * output_blocksize + seek_bytes;
           unsigned long int obs = output_blocksize;
 
           if (OFF_T_MAX / output_blocksize < seek_records)
@@ -2400,32 +7224,56 @@ main (int argc, char **argv)
                      " (%lu-byte) blocks"),
                    seek_records, obs);
 
-          if (iftruncate (STDOUT_FILENO, size) != 0)
-            {
-              /* Complain only when ftruncate fails on a regular file, a
-                 directory, or a shared memory object, as POSIX 1003.1-2004
-                 specifies ftruncate's behavior only for these file types.
-                 For example, do not complain when Linux kernel 2.4 ftruncate
-                 fails on /dev/fd0.  */
-              int ftruncate_errno = errno;
-              struct stat stdout_stat;
-              if (fstat (STDOUT_FILENO, &stdout_stat) != 0)
-                error (EXIT_FAILURE, errno, _("cannot fstat %s"),
-                       quoteaf (output_file));
-              if (S_ISREG (stdout_stat.st_mode)
-                  || S_ISDIR (stdout_stat.st_mode)
-                  || S_TYPEISSHM (&stdout_stat))
-                error (EXIT_FAILURE, ftruncate_errno,
-                       _("failed to truncate to %"PRIuMAX" bytes"
-                         " in output file %s"),
-                       size, quoteaf (output_file));
-            }
+          /* Truncate later, in dd_copy, through the final backend.  */
+          truncate_output = true;
+        }
+
+      extra_output_fds = xnmalloc (n_extra_outputs, sizeof *extra_output_fds);
+      for (j = 0; j < n_extra_outputs; j++)
+        {
+          extra_output_fds[j] = (o_socket
+                                 ? open_socket (-1, extra_output_files[j],
+                                                false)
+                                 : open (extra_output_files[j],
+                                         O_WRONLY | opts, perms));
+          if (extra_output_fds[j] < 0)
+            error (EXIT_FAILURE, errno, _("failed to open %s"),
+                   quoteaf (extra_output_files[j]));
         }
+      output_backend = select_backend (STDOUT_FILENO);
     }
 
+  grow_pipe (STDIN_FILENO, input_blocksize);
+  grow_pipe (STDOUT_FILENO, output_blocksize);
+  tune_socket (STDIN_FILENO, input_blocksize);
+  tune_socket (STDOUT_FILENO, output_blocksize);
+
+  /* The size of compressed output cannot be told in advance, and
+     space reserved for conv=sparse would fill in the holes.  */
+  if ((output_flags & O_PREALLOC) && ! output_compression
+      && ! (conversions_mask & C_SPARSE))
+    preallocate_size = expected_output_size ();
+
+  if (numa_auto)
+    {
+      numa_node = device_numa_node (STDIN_FILENO);
+      if (numa_node < 0)
+        numa_node = device_numa_node (STDOUT_FILENO);
+    }
+  if (0 <= numa_node)
+    bind_numa_node (numa_node);
+
+  if (stats_format)
+    start_cycle_counter ();
+
   start_time = previous_time = gethrxtime ();
 
-  exit_status = dd_copy ();
+#ifdef DD_FAULT_INJECTION
+  if (use_reference_copy)
+    exit_status = reference_copy ();
+  else
+#endif
+    exit_status = dd_copy ();
 
   if (max_records == 0 && max_bytes == 0)
     {
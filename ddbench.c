@@ -0,0 +1,487 @@
+/* ddbench -- microbenchmarks for the conversion kernels of dd
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* This times translate_buffer, swab_buffer, copy_with_block,
+   copy_with_unblock, copy_simple and is_nul on buffers in memory, over
+   a sweep of sizes, alignments and record lengths, with the caches
+   warm and cold, and prints cycles per byte in CSV.  It includes dd.c,
+   so it times the very code dd runs, and it is built the same way:
+
+       cc $CFLAGS -o ddbench ddbench.c $LDLIBS
+
+   Nothing is written out during a timed call: the output buffer is
+   made big enough to hold all the output of the call.  */
+
+#define main dd_main
+#include "dd.c"
+#undef main
+
+/* The kernels, in the order they are reported.  */
+enum
+  {
+    B_TRANSLATE,
+    B_SWAB,
+    B_BLOCK,
+    B_UNBLOCK,
+    B_COPY,
+    B_IS_NUL,
+    N_BENCH_KERNELS
+  };
+
+static char const *const bench_kernel_names[N_BENCH_KERNELS] =
+{
+  "translate", "swab", "block", "unblock", "copy", "is_nul"
+};
+
+/* The default sweep.  */
+static char const default_sizes[] = "64,512,4K,32K,256K,2M,16M";
+static char const default_aligns[] = "0,1,8";
+static char const default_lengths[] = "1-20,80,1-160,1000";
+
+/* Keep calling a kernel while the caches are warm until it has
+   processed this many bytes, and at least MIN_CALLS times.  With the
+   caches cold, call it at most MAX_COLD_CALLS times.  */
+static uintmax_t min_bytes = 64 * 1024 * 1024;
+#define MIN_CALLS 3
+#define MAX_COLD_CALLS 16
+
+/* A buffer that is written over to push the kernel's data out of the
+   caches, and its size.  */
+static char *flush_buf;
+static size_t flush_size;
+
+/* Return a clock for timing the kernels: the time stamp counter on
+   x86, which counts reference cycles, and nanoseconds elsewhere.  */
+
+#if defined __x86_64__ || defined __i386__
+# define BENCH_UNIT "ref_cycles"
+static inline uint64_t
+bench_clock (void)
+{
+  return __rdtsc ();
+}
+#else
+# define BENCH_UNIT "ns"
+static inline uint64_t
+bench_clock (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * (uint64_t) 1000000000 + ts.tv_nsec;
+}
+#endif
+
+static void ATTRIBUTE_NORETURN
+bench_usage (int status)
+{
+  fprintf (status == EXIT_SUCCESS ? stdout : stderr,
+           "Usage: %s [-s SIZES] [-a ALIGNS] [-l LENGTHS] [-b CBS]"
+           " [-k KERNELS] [-n BYTES]\n"
+           "Time the conversion kernels of dd and print cycles per byte"
+           " in CSV.\n"
+           "\n"
+           "  -s SIZES    buffer sizes in bytes (default %s)\n"
+           "  -a ALIGNS   offsets of the buffer from a page boundary"
+           " (default %s)\n"
+           "  -l LENGTHS  lengths of the lines for conv=block and of the\n"
+           "              text in the records for conv=unblock, each N or"
+           " a uniform\n"
+           "              range N-M (default %s)\n"
+           "  -b CBS      conversion block size (default 80)\n"
+           "  -k KERNELS  kernels to time (default all of"
+           " translate,swab,block,\n"
+           "              unblock,copy,is_nul)\n"
+           "  -n BYTES    bytes to process per measurement with warm caches"
+           " (default 64M)\n"
+           "\n"
+           "Lists are separated by commas.  Sizes may end in K, M or G.\n"
+           "The thread pool of the kernels is as big as OMP_NUM_THREADS"
+           " allows.\n",
+           program_name, default_sizes, default_aligns, default_lengths);
+  exit (status);
+}
+
+/* Return the number in STR, which may end in K, M or G, and store
+   the end of it in *END.  */
+
+static uintmax_t
+bench_number (char const *str, char **end)
+{
+  uintmax_t n;
+
+  errno = 0;
+  n = strtoumax (str, end, 10);
+  if (errno || *end == str)
+    error (EXIT_FAILURE, 0, "invalid number: %s", quote (str));
+  if (**end && strchr ("KMG", **end))
+    n <<= 10 * (strchr ("KMG", *(*end)++) - "KMG" + 1);
+  return n;
+}
+
+/* Parse the comma separated list LIST of numbers into a new array,
+   and store its length in *N.  */
+
+static uintmax_t *
+parse_list (char const *list, size_t *n)
+{
+  size_t n_alloc = 0;
+  uintmax_t *v = NULL;
+  char *end;
+
+  *n = 0;
+  for (;;)
+    {
+      if (*n == n_alloc)
+        v = x2nrealloc (v, &n_alloc, sizeof *v);
+      v[(*n)++] = bench_number (list, &end);
+      if (*end == '\0')
+        return v;
+      if (*end != ',')
+        error (EXIT_FAILURE, 0, "invalid list: %s", quote (list));
+      list = end + 1;
+    }
+}
+
+/* A distribution of line lengths: uniform from LO to HI.  */
+struct lengths
+{
+  char const *name;
+  size_t lo;
+  size_t hi;
+};
+
+/* Parse the comma separated list LIST of lengths, each N or N-M, into
+   a new array, and store its length in *N.  */
+
+static struct lengths *
+parse_lengths (char *list, size_t *n)
+{
+  size_t n_alloc = 0;
+  struct lengths *v = NULL;
+  char *tok;
+  char *end;
+
+  *n = 0;
+  for (tok = strtok (list, ","); tok; tok = strtok (NULL, ","))
+    {
+      if (*n == n_alloc)
+        v = x2nrealloc (v, &n_alloc, sizeof *v);
+      v[*n].name = tok;
+      v[*n].lo = v[*n].hi = bench_number (tok, &end);
+      if (*end == '-')
+        v[*n].hi = bench_number (end + 1, &end);
+      if (*end || v[*n].hi < v[*n].lo)
+        error (EXIT_FAILURE, 0, "invalid length: %s", quote (tok));
+      ++*n;
+    }
+  return v;
+}
+
+/* Return a length drawn from L.  */
+
+static size_t
+draw_length (struct lengths const *l)
+{
+  return l->lo + (size_t) random () % (l->hi - l->lo + 1);
+}
+
+/* Fill the SIZE bytes of BUF with text, letters with a few spaces
+   in between.  */
+
+static void
+fill_text (char *buf, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    buf[i] = random () % 6 ? 'a' + random () % 26 : ' ';
+}
+
+/* Fill the SIZE bytes of BUF with the input of KERNEL, using the line
+   lengths L for conv=block and conv=unblock.  Return the most output
+   the kernel can make from it.  */
+
+static size_t
+fill_input (int kernel, char *buf, size_t size, struct lengths const *l)
+{
+  size_t i;
+  size_t lines = 0;
+
+  switch (kernel)
+    {
+    case B_BLOCK:
+      /* Lines of text, each ended by a newline.  */
+      for (i = 0; i < size; )
+        {
+          size_t len = draw_length (l);
+          len = MIN (len, size - i);
+          fill_text (buf + i, len);
+          i += len;
+          if (i < size)
+            {
+              buf[i++] = '\n';
+              lines++;
+            }
+        }
+      return (lines + 1) * conversion_blocksize;
+
+    case B_UNBLOCK:
+      /* Records of text padded with spaces.  */
+      for (i = 0; i < size; i += conversion_blocksize)
+        {
+          size_t rec = MIN (conversion_blocksize, size - i);
+          size_t len = draw_length (l);
+          len = MIN (len, rec);
+          fill_text (buf + i, len);
+          memset (buf + i + len, ' ', rec - len);
+        }
+      return size + size / conversion_blocksize + 1;
+
+    case B_IS_NUL:
+      /* All NULs, so that is_nul has to look at every byte.  */
+      memset (buf, 0, size);
+      return 0;
+
+    default:
+      fill_text (buf, size);
+      return size;
+    }
+}
+
+/* Push everything out of the caches by writing over a buffer twice
+   as big as the last-level cache.  */
+
+static void
+flush_caches (void)
+{
+  size_t i;
+
+  for (i = 0; i < flush_size; i += 64)
+    flush_buf[i]++;
+}
+
+/* Call KERNEL once on the SIZE bytes of BUF, and empty the output.  */
+
+static void
+run_kernel (int kernel, char *buf, size_t size)
+{
+  size_t n = size;
+
+  switch (kernel)
+    {
+    case B_TRANSLATE:
+      translate_buffer (buf, size);
+      break;
+    case B_SWAB:
+      char_is_saved = false;
+      swab_buffer (buf, &n);
+      break;
+    case B_BLOCK:
+      copy_with_block (buf, size);
+      break;
+    case B_UNBLOCK:
+      copy_with_unblock (buf, size);
+      break;
+    case B_COPY:
+      copy_simple (buf, size);
+      break;
+    case B_IS_NUL:
+      if (! is_nul (buf, size))
+        abort ();
+      break;
+    }
+  oc = 0;
+  col = 0;
+  pending_spaces = 0;
+}
+
+/* Time KERNEL on the SIZE bytes of BUF, with the caches warm, or cold
+   if COLD, and print a record describing the run with ALIGN and
+   LENGTHS.  */
+
+static void
+time_kernel (int kernel, char *buf, size_t size, size_t align,
+             char const *lengths, bool cold)
+{
+  uintmax_t calls = 0;
+  uintmax_t bytes = 0;
+  uint64_t ticks = 0;
+
+  if (! cold)
+    run_kernel (kernel, buf, size);
+
+  while (calls < MIN_CALLS
+         || (bytes < min_bytes && (! cold || calls < MAX_COLD_CALLS)))
+    {
+      uint64_t start;
+
+      if (cold)
+        flush_caches ();
+      start = bench_clock ();
+      run_kernel (kernel, buf, size);
+      ticks += bench_clock () - start;
+      calls++;
+      bytes += size;
+    }
+
+  printf ("%s,%zu,%zu,%s,%s,%"PRIuMAX",%"PRIuMAX",%.4f\n",
+          bench_kernel_names[kernel], size, align, lengths,
+          cold ? "cold" : "warm", calls, bytes, (double) ticks / bytes);
+}
+
+int
+main (int argc, char **argv)
+{
+  char const *sizes_arg = default_sizes;
+  char const *aligns_arg = default_aligns;
+  char *lengths_arg = xstrdup (default_lengths);
+  bool kernels[N_BENCH_KERNELS];
+  uintmax_t *sizes;
+  uintmax_t *aligns;
+  struct lengths *lengths;
+  size_t n_sizes;
+  size_t n_aligns;
+  size_t n_lengths;
+  size_t max_size = 0;
+  size_t cache_size;
+  char *base;
+  char *end;
+  char *tok;
+  size_t i, j, l;
+  int k;
+  int c;
+
+  set_program_name (argv[0]);
+  page_size = getpagesize ();
+  conversion_blocksize = 80;
+  for (k = 0; k < N_BENCH_KERNELS; k++)
+    kernels[k] = true;
+
+  while ((c = getopt (argc, argv, "s:a:l:b:k:n:h")) != -1)
+    switch (c)
+      {
+      case 's':
+        sizes_arg = optarg;
+        break;
+      case 'a':
+        aligns_arg = optarg;
+        break;
+      case 'l':
+        lengths_arg = optarg;
+        break;
+      case 'b':
+        conversion_blocksize = bench_number (optarg, &end);
+        if (*end || ! conversion_blocksize)
+          error (EXIT_FAILURE, 0, "invalid block size: %s", quote (optarg));
+        break;
+      case 'k':
+        for (k = 0; k < N_BENCH_KERNELS; k++)
+          kernels[k] = false;
+        for (tok = strtok (optarg, ","); tok; tok = strtok (NULL, ","))
+          {
+            for (k = 0; k < N_BENCH_KERNELS; k++)
+              if (STREQ (tok, bench_kernel_names[k]))
+                break;
+            if (k == N_BENCH_KERNELS)
+              error (EXIT_FAILURE, 0, "unknown kernel: %s", quote (tok));
+            kernels[k] = true;
+          }
+        break;
+      case 'n':
+        min_bytes = bench_number (optarg, &end);
+        if (*end)
+          error (EXIT_FAILURE, 0, "invalid number: %s", quote (optarg));
+        break;
+      case 'h':
+        bench_usage (EXIT_SUCCESS);
+      default:
+        bench_usage (EXIT_FAILURE);
+      }
+  if (optind != argc)
+    bench_usage (EXIT_FAILURE);
+
+  sizes = parse_list (sizes_arg, &n_sizes);
+  aligns = parse_list (aligns_arg, &n_aligns);
+  lengths = parse_lengths (lengths_arg, &n_lengths);
+  for (i = 0; i < n_sizes; i++)
+    max_size = MAX (max_size, sizes[i]);
+  for (i = 0; i < n_aligns; i++)
+    if (page_size <= aligns[i])
+      error (EXIT_FAILURE, 0, "alignment %"PRIuMAX" is not below the"
+             " page size", aligns[i]);
+
+  /* Room for the bytes that swab_buffer writes around the buffer.  */
+  base = xmalloc (max_size + 3 * page_size);
+
+  for (i = 0; i < 256; i++)
+    trans_table[i] = i;
+  translate_charset (ascii_to_ebcdic);
+
+  cache_size = 0;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+  cache_size = MAX (0, sysconf (_SC_LEVEL3_CACHE_SIZE));
+#endif
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  if (! cache_size)
+    cache_size = MAX (0, sysconf (_SC_LEVEL2_CACHE_SIZE));
+#endif
+  flush_size = 2 * (cache_size ? cache_size : 64 * 1024 * 1024);
+  flush_buf = xcalloc (flush_size, 1);
+
+  printf ("kernel,size,align,lengths,cache,calls,bytes,%s_per_byte\n",
+          BENCH_UNIT);
+
+  for (k = 0; k < N_BENCH_KERNELS; k++)
+    {
+      bool lined = k == B_BLOCK || k == B_UNBLOCK;
+
+      if (! kernels[k])
+        continue;
+      for (i = 0; i < n_sizes; i++)
+        {
+          size_t size = sizes[i];
+
+#ifdef __SSE2__
+          /* Stream the output as dd would with bs=SIZE.  */
+          streaming_stores = cache_size && cache_size < size;
+#endif
+          for (j = 0; j < n_aligns; j++)
+            {
+              char *buf = ptr_align (base + page_size, page_size) + aligns[j];
+
+              for (l = 0; l < (lined ? n_lengths : 1); l++)
+                {
+                  /* Make the output buffer big enough for all the
+                     output, which for conv=block can be much bigger
+                     than the input, so that nothing is written out.  */
+                  size_t out_size = fill_input (k, buf, size, &lengths[l]);
+                  if (output_blocksize <= out_size)
+                    {
+                      output_blocksize = out_size + 1;
+                      obuf = xrealloc (obuf, output_blocksize);
+                    }
+
+                  time_kernel (k, buf, size, aligns[j],
+                               lined ? lengths[l].name : "", false);
+                  time_kernel (k, buf, size, aligns[j],
+                               lined ? lengths[l].name : "", true);
+                }
+            }
+        }
+    }
+
+  return EXIT_SUCCESS;
+}
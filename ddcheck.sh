@@ -0,0 +1,122 @@
+#!/bin/sh
+# Differential test of dd: run dd_copy and the reference copy loop of
+# the testing build over random operands, with the same short reads,
+# and check that they give the same output, exit status and counts.
+#
+# Usage: ddcheck.sh [RUNS [SEED]]
+#
+# RUNS operand sets (default 500) are drawn from SEED (default 1), so
+# a failure can be replayed.  Each draws ibs=, obs=, cbs=, conv=,
+# skip=, count=, iflag=fullblock, a DD_SHORT_READS seed and at times
+# a DD_FAULTS read error, over random bytes or lines of text.  The
+# records of stats=csv must agree in bytes, records in and out, and
+# read and write system calls.
+#
+# dd is built from dd.c next to this script with fault injection:
+#
+#     $CC $CFLAGS -DDD_FAULT_INJECTION -o dd dd.c $LDLIBS
+#
+# so CFLAGS and LDLIBS have to find what dd.c includes and links with.
+# Set DD to a dd that is already built with -DDD_FAULT_INJECTION to
+# skip this.
+#
+# Block sizes are drawn up to MAX_BLOCK bytes (default 4096).  Raise it
+# to a few MiB, with OMP_NUM_THREADS above 1, to check the parallel
+# conversions as well.
+
+: ${CC=cc}
+: ${MAX_BLOCK=4096}
+runs=${1-500}
+seed=${2-1}
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' 0
+trap 'exit 1' 1 2 13 15
+
+if test -z "$DD"; then
+  DD=$tmp/dd
+  $CC $CFLAGS -DDD_FAULT_INJECTION -o "$DD" "$(dirname "$0")/dd.c" \
+      $LDLIBS || exit 1
+fi
+
+# The inputs hold at least four of the biggest blocks.
+bs=$((MAX_BLOCK > 65536 ? MAX_BLOCK : 65536))
+"$DD" if=/dev/urandom of="$tmp/bytes" bs=$bs count=4 status=none || exit 1
+od -An -tx1 -w30 "$tmp/bytes" | sed 's/  */ /g' > "$tmp/text"
+
+# Draw the operand sets, one per line: the input, the environment
+# and the operands.  Conversions that dd would reject together are
+# not drawn together: conv=ascii implies unblock, and conv=ebcdic and
+# conv=ibm imply block.
+awk -v runs="$runs" -v seed="$seed" -v max="$MAX_BLOCK" -v dir="$tmp" '
+function pick(n) { return int(rand() * n) }
+BEGIN {
+  srand(seed)
+  for (n = 0; n < runs; n++) {
+    conv = ""
+    charset = pick(6)
+    if (charset == 1) conv = conv ",ascii"
+    else if (charset == 2) conv = conv ",ebcdic"
+    else if (charset == 3) conv = conv ",ibm"
+    if (pick(4) == 0) conv = conv (pick(2) ? ",ucase" : ",lcase")
+    blocking = pick(4)
+    if (blocking == 1 && charset != 1) conv = conv ",block"
+    else if (blocking == 2 && charset != 2 && charset != 3)
+      conv = conv ",unblock"
+    if (pick(4) == 0) conv = conv ",swab"
+    if (pick(4) == 0) conv = conv ",sync"
+    noerror = pick(4) == 0
+    if (noerror) conv = conv ",noerror"
+
+    ops = "cbs=" (1 + pick(100))
+    if (pick(3) == 0)
+      ops = ops " bs=" (1 + pick(max))
+    else
+      ops = ops " ibs=" (1 + pick(max)) " obs=" (1 + pick(max))
+    if (conv != "") ops = ops " conv=" substr(conv, 2)
+    if (pick(2)) ops = ops " skip=" pick(8)
+    if (pick(2)) ops = ops " count=" pick(600)
+    if (pick(2)) ops = ops " iflag=fullblock"
+
+    env = "DD_SHORT_READS=" (1 + pick(65535))
+    if (noerror && pick(2))
+      env = env " DD_FAULTS=eio@" pick(4 * max)
+
+    print (pick(2) ? dir "/bytes" : dir "/text") "|" env "|" ops
+  }
+}' > "$tmp/runs" || exit 1
+
+# Whether files $1 and $2 are the same, or both missing.
+same ()
+{
+  if test -e "$1" || test -e "$2"; then
+    cmp -s "$1" "$2"
+  fi
+}
+
+failures=0
+while IFS='|' read -r input env ops; do
+  rm -f "$tmp/out" "$tmp/ref"
+  env $env "$DD" if="$input" of="$tmp/out" $ops stats=csv status=none \
+      2> "$tmp/out.stats"
+  status=$?
+  env $env DD_REFERENCE=1 "$DD" if="$input" of="$tmp/ref" $ops stats=csv \
+      status=none 2> "$tmp/ref.stats"
+  ref_status=$?
+
+  tail -n 1 "$tmp/out.stats" | cut -d, -f1,3-8 > "$tmp/out.counts"
+  tail -n 1 "$tmp/ref.stats" | cut -d, -f1,3-8 > "$tmp/ref.counts"
+  if test $status -ne $ref_status \
+     || ! same "$tmp/out" "$tmp/ref" \
+     || ! same "$tmp/out.counts" "$tmp/ref.counts"; then
+    echo "FAIL: $env dd if=$input $ops"
+    echo "  exit status $status, reference $ref_status"
+    echo "  counts $(cat "$tmp/out.counts"), reference" \
+         "$(cat "$tmp/ref.counts")"
+    cmp "$tmp/out" "$tmp/ref" 2>&1 | sed 's/^/  /'
+    failures=$((failures + 1))
+  fi
+done < "$tmp/runs"
+
+echo "$runs runs, $failures failures"
+test $failures -eq 0
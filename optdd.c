@@ -1,3 +1,8 @@
+// ask for the GNU and large file interfaces (O_DIRECT, O_NOATIME, a 64 bit off_t)
+// these have to be defined before the first system header is included
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
 // parse commandline options
 #include <getopt.h> // getopt_long, optind
 // constants
@@ -13,6 +18,23 @@
 #include <error.h> // error
 // IO
 #include <stdio.h> // fprintf, stderr
+// booleans
+#include <stdbool.h> // bool, true, false
+// strings and memory
+#include <string.h> // strchr, strlen, memcpy, memset
+#include <ctype.h> // isdigit, toupper, tolower
+// error numbers
+#include <errno.h> // errno, EINTR, EOVERFLOW
+// files
+#include <fcntl.h> // open, fcntl, posix_fadvise, O_* flags
+#include <sys/stat.h> // fstat, S_ISREG
+// integer formatting and limits
+#include <inttypes.h> // PRIuMAX, strtoumax
+#include <limits.h> // CHAR_BIT, SSIZE_MAX
+// timing
+#include <time.h> // clock_gettime
+// threads, for stages that run concurrently
+#include <pthread.h> // pthread_create, pthread_mutex_t, pthread_cond_t
 
 
 #define PROGRAM_NAME "dd"
@@ -34,6 +56,36 @@ static char const * input_file = NULL;
 /* The name of the output file, or NULL for the standard output. */
 static char const * output_file = NULL;
 
+// until this links against gnulib, quoting and message translation do nothing
+// the gnu dd wraps every user visible string in _() and every quoted name in quote()
+#define quote(arg) (arg)
+#define _(msgid) (msgid)
+#define N_(msgid) (msgid)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// the largest off_t, this works because _FILE_OFFSET_BITS makes off_t a signed 64 bit type
+#define OFF_T_MAX ((off_t) (((uintmax_t) 1 << (sizeof (off_t) * CHAR_BIT - 1)) - 1))
+
+/* Default input and output blocksize. */
+#define DEFAULT_BLOCKSIZE 512
+
+/* How many bytes to add to the input and output block sizes before
+   allocating.  Buffers start a page in, see buffer_get. */
+#define INPUT_BLOCK_SLOP (page_size)
+#define OUTPUT_BLOCK_SLOP (page_size)
+
+/* Maximum blocksize for the given SLOP. */
+#define MAX_BLOCKSIZE(slop) MIN (SIZE_MAX - (slop), (size_t) SSIZE_MAX)
+
+// a name=value pair, used for the tables of conv=, iflag=, oflag= and status= symbols
+// the symbol is an array, not a pointer, so the tables are one contiguous block
+struct symbol_value {
+    char const symbol[sizeof "count_bytes"];
+    int value;
+};
+
 /* Conversions bit masks. */
 // bit flags is more faster than string comparison
 enum {
@@ -83,8 +135,313 @@ static struct symbol_value const conversions[] = {
     {"", 0}
 };
 
+// some platforms lack some of these flags, treat the missing ones as 0
+// so that the flag is accepted but does nothing
+#ifndef O_CIO
+# define O_CIO 0
+#endif
+#ifndef O_NOLINKS
+# define O_NOLINKS 0
+#endif
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+#ifndef O_TEXT
+# define O_TEXT 0
+#endif
+#ifndef O_RSYNC
+# define O_RSYNC 0
+#endif
+
+// FFS_MASK keeps only the lowest set bit of x
+#define FFS_MASK(x) ((x) ^ ((x) & ((x) - 1)))
+
+// dd has some flags of its own, which go in the same int as the open flags
+// so they take the lowest bits that no open flag we pass through uses
+enum {
+    /* Compute a value that's bitwise disjoint from the union
+       of all O_ values.  */
+    v = ~(0
+          | O_APPEND
+          | O_BINARY
+          | O_CIO
+          | O_DIRECT
+          | O_DIRECTORY
+          | O_DSYNC
+          | O_NOATIME
+          | O_NOCTTY
+          | O_NOFOLLOW
+          | O_NOLINKS
+          | O_NONBLOCK
+          | O_SYNC
+          | O_TEXT
+          ),
+
+    /* Use its lowest bits for private flags.  */
+    O_FULLBLOCK = FFS_MASK (v),
+    v2 = v ^ O_FULLBLOCK,
+
+    O_NOCACHE = FFS_MASK (v2),
+    v3 = v2 ^ O_NOCACHE,
+
+    O_COUNT_BYTES = FFS_MASK (v3),
+    v4 = v3 ^ O_COUNT_BYTES,
+
+    O_SKIP_BYTES = FFS_MASK (v4),
+    v5 = v4 ^ O_SKIP_BYTES,
+
+    O_SEEK_BYTES = FFS_MASK (v5),
+
+    // all of the private flags, these must never reach open or fcntl
+    // (the lowest bit is O_WRONLY!)
+    O_PRIVATE = (O_FULLBLOCK | O_NOCACHE | O_COUNT_BYTES
+                 | O_SKIP_BYTES | O_SEEK_BYTES)
+};
+
+/* Flags, for iflag="..." and oflag="...".  */
+static struct symbol_value const flags[] = {
+    {"append", O_APPEND},
+    {"binary", O_BINARY},
+    {"cio", O_CIO},
+    {"direct", O_DIRECT},
+    {"directory", O_DIRECTORY},
+    {"dsync", O_DSYNC},
+    {"noatime", O_NOATIME},
+    {"nocache", O_NOCACHE},   /* Discard cache.  */
+    {"noctty", O_NOCTTY},
+    {"nofollow", O_NOFOLLOW},
+    {"nolinks", O_NOLINKS},
+    {"nonblock", O_NONBLOCK},
+    {"sync", O_SYNC},
+    {"text", O_TEXT},
+    {"fullblock", O_FULLBLOCK},   /* Accumulate full blocks from input.  */
+    {"count_bytes", O_COUNT_BYTES},
+    {"skip_bytes", O_SKIP_BYTES},
+    {"seek_bytes", O_SEEK_BYTES},
+    {"", 0}
+};
+
+/* Status levels.  */
+enum {
+    STATUS_NONE = 1,
+    STATUS_NOXFER = 2,
+    STATUS_DEFAULT = 3
+};
+
+/* Status, for status="...".  */
+static struct symbol_value const statuses[] = {
+    {"none", STATUS_NONE},
+    {"noxfer", STATUS_NOXFER},
+    {"", 0}
+};
+
+// the outcome of parsing a number, as with gnulib's xstrtol
+typedef enum {
+    LONGINT_OK = 0,
+    LONGINT_OVERFLOW = 1,
+    LONGINT_INVALID = 4
+} strtol_error;
+
+/* The number of bytes in which atomic reads are done. */
+static size_t input_blocksize = 0;
+
+/* The number of bytes in which atomic writes are done. */
+static size_t output_blocksize = 0;
+
+/* Conversion buffer size, in bytes.  0 prevents conversions. */
+static size_t conversion_blocksize = 0;
+
+/* Skip this many records of 'input_blocksize' bytes before input. */
+static uintmax_t skip_records = 0;
+
+/* Skip this many bytes before input in addition of 'skip_records'
+   records.  */
+static size_t skip_bytes = 0;
+
+/* Skip this many records of 'output_blocksize' bytes before output. */
+static uintmax_t seek_records = 0;
+
+/* Skip this many bytes in addition to 'seek_records' records before
+   output.  */
+static size_t seek_bytes = 0;
+
+/* Copy only this many records.  The default is effectively infinity.  */
+static uintmax_t max_records = (uintmax_t) -1;
+
+/* Copy this many bytes in addition to 'max_records' records.  */
+static size_t max_bytes = 0;
+
+/* Bit vector of conversions to apply. */
+static int conversions_mask = 0;
+
+/* Open flags for the input and output files. */
+static int input_flags = 0;
+static int output_flags = 0;
+
+/* Status flags for what is printed to stderr.  */
+static int status_level = STATUS_DEFAULT;
+
+/* Whether to discard the cache of the input or output once copied.  */
+static bool i_nocache;
+static bool o_nocache;
+
+/* If nonzero, warn about partial reads, see iread.  */
+static bool warn_partial_read;
+
+// iread or iread_fullblock, picked by scanargs
+static ssize_t (* iread_fnc) (int fd, char * buf, size_t size);
+
+/* Number of partial blocks written. */
+static uintmax_t w_partial = 0;
+
+/* Number of full blocks written. */
+static uintmax_t w_full = 0;
+
+/* Number of partial blocks read. */
+static uintmax_t r_partial = 0;
+
+/* Number of full blocks read. */
+static uintmax_t r_full = 0;
+
+/* Number of bytes written.  */
+static uintmax_t w_bytes = 0;
+
+/* Records truncated by conv=block. */
+static uintmax_t r_truncate = 0;
+
+/* True if input is seekable.  */
+static bool input_seekable;
+
+/* Whether the final output was done with a seek (rather than a write).  */
+static bool final_op_was_seek;
+
+/* Output representation of newline and space characters.
+   They change if we're converting to EBCDIC.  */
+static char newline_character = '\n';
+static char space_character = ' ';
+
+/* Translation table formed by applying successive transformations. */
+static unsigned char trans_table[256];
+
+// whether trans_table does anything, if not the translate stage is left out
+static bool translation_needed = false;
+
+/* Standard translation tables, taken from POSIX 1003.1-2013.
+   Beware of imitations; there are lots of ASCII<->EBCDIC tables
+   floating around the net, perhaps valid for some applications but
+   not correct here.  */
+
+static char const ascii_to_ebcdic[] =
+{
+  '\000', '\001', '\002', '\003', '\067', '\055', '\056', '\057',
+  '\026', '\005', '\045', '\013', '\014', '\015', '\016', '\017',
+  '\020', '\021', '\022', '\023', '\074', '\075', '\062', '\046',
+  '\030', '\031', '\077', '\047', '\034', '\035', '\036', '\037',
+  '\100', '\132', '\177', '\173', '\133', '\154', '\120', '\175',
+  '\115', '\135', '\134', '\116', '\153', '\140', '\113', '\141',
+  '\360', '\361', '\362', '\363', '\364', '\365', '\366', '\367',
+  '\370', '\371', '\172', '\136', '\114', '\176', '\156', '\157',
+  '\174', '\301', '\302', '\303', '\304', '\305', '\306', '\307',
+  '\310', '\311', '\321', '\322', '\323', '\324', '\325', '\326',
+  '\327', '\330', '\331', '\342', '\343', '\344', '\345', '\346',
+  '\347', '\350', '\351', '\255', '\340', '\275', '\232', '\155',
+  '\171', '\201', '\202', '\203', '\204', '\205', '\206', '\207',
+  '\210', '\211', '\221', '\222', '\223', '\224', '\225', '\226',
+  '\227', '\230', '\231', '\242', '\243', '\244', '\245', '\246',
+  '\247', '\250', '\251', '\300', '\117', '\320', '\137', '\007',
+  '\040', '\041', '\042', '\043', '\044', '\025', '\006', '\027',
+  '\050', '\051', '\052', '\053', '\054', '\011', '\012', '\033',
+  '\060', '\061', '\032', '\063', '\064', '\065', '\066', '\010',
+  '\070', '\071', '\072', '\073', '\004', '\024', '\076', '\341',
+  '\101', '\102', '\103', '\104', '\105', '\106', '\107', '\110',
+  '\111', '\121', '\122', '\123', '\124', '\125', '\126', '\127',
+  '\130', '\131', '\142', '\143', '\144', '\145', '\146', '\147',
+  '\150', '\151', '\160', '\161', '\162', '\163', '\164', '\165',
+  '\166', '\167', '\170', '\200', '\212', '\213', '\214', '\215',
+  '\216', '\217', '\220', '\152', '\233', '\234', '\235', '\236',
+  '\237', '\240', '\252', '\253', '\254', '\112', '\256', '\257',
+  '\260', '\261', '\262', '\263', '\264', '\265', '\266', '\267',
+  '\270', '\271', '\272', '\273', '\274', '\241', '\276', '\277',
+  '\312', '\313', '\314', '\315', '\316', '\317', '\332', '\333',
+  '\334', '\335', '\336', '\337', '\352', '\353', '\354', '\355',
+  '\356', '\357', '\372', '\373', '\374', '\375', '\376', '\377'
+};
+
+static char const ascii_to_ibm[] =
+{
+  '\000', '\001', '\002', '\003', '\067', '\055', '\056', '\057',
+  '\026', '\005', '\045', '\013', '\014', '\015', '\016', '\017',
+  '\020', '\021', '\022', '\023', '\074', '\075', '\062', '\046',
+  '\030', '\031', '\077', '\047', '\034', '\035', '\036', '\037',
+  '\100', '\132', '\177', '\173', '\133', '\154', '\120', '\175',
+  '\115', '\135', '\134', '\116', '\153', '\140', '\113', '\141',
+  '\360', '\361', '\362', '\363', '\364', '\365', '\366', '\367',
+  '\370', '\371', '\172', '\136', '\114', '\176', '\156', '\157',
+  '\174', '\301', '\302', '\303', '\304', '\305', '\306', '\307',
+  '\310', '\311', '\321', '\322', '\323', '\324', '\325', '\326',
+  '\327', '\330', '\331', '\342', '\343', '\344', '\345', '\346',
+  '\347', '\350', '\351', '\255', '\340', '\275', '\137', '\155',
+  '\171', '\201', '\202', '\203', '\204', '\205', '\206', '\207',
+  '\210', '\211', '\221', '\222', '\223', '\224', '\225', '\226',
+  '\227', '\230', '\231', '\242', '\243', '\244', '\245', '\246',
+  '\247', '\250', '\251', '\300', '\117', '\320', '\241', '\007',
+  '\040', '\041', '\042', '\043', '\044', '\025', '\006', '\027',
+  '\050', '\051', '\052', '\053', '\054', '\011', '\012', '\033',
+  '\060', '\061', '\032', '\063', '\064', '\065', '\066', '\010',
+  '\070', '\071', '\072', '\073', '\004', '\024', '\076', '\341',
+  '\101', '\102', '\103', '\104', '\105', '\106', '\107', '\110',
+  '\111', '\121', '\122', '\123', '\124', '\125', '\126', '\127',
+  '\130', '\131', '\142', '\143', '\144', '\145', '\146', '\147',
+  '\150', '\151', '\160', '\161', '\162', '\163', '\164', '\165',
+  '\166', '\167', '\170', '\200', '\212', '\213', '\214', '\215',
+  '\216', '\217', '\220', '\232', '\233', '\234', '\235', '\236',
+  '\237', '\240', '\252', '\253', '\254', '\255', '\256', '\257',
+  '\260', '\261', '\262', '\263', '\264', '\265', '\266', '\267',
+  '\270', '\271', '\272', '\273', '\274', '\275', '\276', '\277',
+  '\312', '\313', '\314', '\315', '\316', '\317', '\332', '\333',
+  '\334', '\335', '\336', '\337', '\352', '\353', '\354', '\355',
+  '\356', '\357', '\372', '\373', '\374', '\375', '\376', '\377'
+};
+
+static char const ebcdic_to_ascii[] =
+{
+  '\000', '\001', '\002', '\003', '\234', '\011', '\206', '\177',
+  '\227', '\215', '\216', '\013', '\014', '\015', '\016', '\017',
+  '\020', '\021', '\022', '\023', '\235', '\205', '\010', '\207',
+  '\030', '\031', '\222', '\217', '\034', '\035', '\036', '\037',
+  '\200', '\201', '\202', '\203', '\204', '\012', '\027', '\033',
+  '\210', '\211', '\212', '\213', '\214', '\005', '\006', '\007',
+  '\220', '\221', '\026', '\223', '\224', '\225', '\226', '\004',
+  '\230', '\231', '\232', '\233', '\024', '\025', '\236', '\032',
+  '\040', '\240', '\241', '\242', '\243', '\244', '\245', '\246',
+  '\247', '\250', '\325', '\056', '\074', '\050', '\053', '\174',
+  '\046', '\251', '\252', '\253', '\254', '\255', '\256', '\257',
+  '\260', '\261', '\041', '\044', '\052', '\051', '\073', '\176',
+  '\055', '\057', '\262', '\263', '\264', '\265', '\266', '\267',
+  '\270', '\271', '\313', '\054', '\045', '\137', '\076', '\077',
+  '\272', '\273', '\274', '\275', '\276', '\277', '\300', '\301',
+  '\302', '\140', '\072', '\043', '\100', '\047', '\075', '\042',
+  '\303', '\141', '\142', '\143', '\144', '\145', '\146', '\147',
+  '\150', '\151', '\304', '\305', '\306', '\307', '\310', '\311',
+  '\312', '\152', '\153', '\154', '\155', '\156', '\157', '\160',
+  '\161', '\162', '\136', '\314', '\315', '\316', '\317', '\320',
+  '\321', '\345', '\163', '\164', '\165', '\166', '\167', '\170',
+  '\171', '\172', '\322', '\323', '\324', '\133', '\326', '\327',
+  '\330', '\331', '\332', '\333', '\334', '\335', '\336', '\337',
+  '\340', '\341', '\342', '\343', '\344', '\135', '\346', '\347',
+  '\173', '\101', '\102', '\103', '\104', '\105', '\106', '\107',
+  '\110', '\111', '\350', '\351', '\352', '\353', '\354', '\355',
+  '\175', '\112', '\113', '\114', '\115', '\116', '\117', '\120',
+  '\121', '\122', '\356', '\357', '\360', '\361', '\362', '\363',
+  '\134', '\237', '\123', '\124', '\125', '\126', '\127', '\130',
+  '\131', '\132', '\364', '\365', '\366', '\367', '\370', '\371',
+  '\060', '\061', '\062', '\063', '\064', '\065', '\066', '\067',
+  '\070', '\071', '\372', '\373', '\374', '\375', '\376', '\377'
+};
+
 // function prototypes to allow out of order usage!
 void usage (int status);
+static bool operand_matches (char const * str, char const * pattern, char delim);
 static void scanargs (int argc, char * const * argv);
 
 
@@ -94,10 +451,10 @@ usage (int status) {
     if (status != EXIT_SUCCESS) {
         fprintf (stderr, "Try '%s --help' for more information.\n", PROGRAM_NAME);
         // we don't have a --help section yet!
-    } else {
-        exit (status);
     }
 
+    exit (status);
+
 }
 
 // C strings cannot be compared using just ==, they must be compared bytewise
@@ -135,6 +492,181 @@ static bool operand_matches (char const * str, char const * pattern, char delim)
 
 }
 
+// true if more than one bit of i is set, used to reject conflicting conversions
+static bool
+multiple_bits_set (int i) {
+    return (i & (i - 1)) != 0;
+}
+
+// parse a comma separated list of symbols like "notrunc,sync" against table
+// if exclusive, only the last symbol counts (like status=), otherwise they are or'ed together
+static int
+parse_symbols (char const * str, struct symbol_value const * table, bool exclusive, char const * error_msgid) {
+
+    int value = 0;
+
+    while (true) {
+
+        char const * strcomma = strchr (str, ',');
+        struct symbol_value const * entry;
+
+        // a symbol with value 0 is not supported on this platform, so keep looking
+        // the table ends with an empty symbol, reaching it means str is unknown
+        for (entry = table; ! (operand_matches (str, entry->symbol, ',') && entry->value); entry++) {
+            if (! entry->symbol[0]) {
+                size_t slen = strcomma ? (size_t) (strcomma - str) : strlen (str);
+                error (0, 0, "%s: %.*s", _(error_msgid), (int) slen, str);
+                usage (EXIT_FAILURE);
+            }
+        }
+
+        if (exclusive) {
+            value = entry->value;
+        } else {
+            value |= entry->value;
+        }
+
+        if (! strcomma) {
+            break;
+        }
+        str = strcomma + 1;
+    }
+
+    return value;
+
+}
+
+// multiply *n by m, returning false instead of wrapping around
+static bool
+multiply_checked (uintmax_t * n, uintmax_t m) {
+    if (m != 0 && UINTMAX_MAX / m < *n) {
+        return false;
+    }
+    *n *= m;
+    return true;
+}
+
+// parse a number like "4096", "4K", "1MB", "10b" or "2x512"
+// the suffixes are the ones gnu dd accepts:
+// c = 1, w = 2, b = 512, K = 1024, KB = 1000, and so on up through M, G, T, P and E
+static uintmax_t
+parse_integer (char const * str, strtol_error * invalid) {
+
+    char * suffix;
+    uintmax_t n;
+
+    // strtoumax would quietly accept "-1" or " 1"
+    if (! isdigit ((unsigned char) *str)) {
+        *invalid = LONGINT_INVALID;
+        return 0;
+    }
+
+    errno = 0;
+    n = strtoumax (str, &suffix, 10);
+    if (errno == ERANGE) {
+        *invalid = LONGINT_OVERFLOW;
+        return UINTMAX_MAX;
+    }
+
+    if (*suffix == 'c') {
+        suffix++;
+    } else if (*suffix == 'w' || *suffix == 'b') {
+        if (! multiply_checked (&n, *suffix == 'w' ? 2 : 512)) {
+            *invalid = LONGINT_OVERFLOW;
+            return UINTMAX_MAX;
+        }
+        suffix++;
+    } else if (*suffix && strchr ("kKMGTPE", *suffix)) {
+
+        // the power of the multiplier, K is 1, M is 2...
+        int power = *suffix == 'k' ? 1 : strchr ("KMGTPE", *suffix) - "KMGTPE" + 1;
+        uintmax_t base = 1024;
+
+        if (suffix[1] == 'B') {
+            base = 1000;
+            suffix += 2;
+        } else if (suffix[1] == 'i' && suffix[2] == 'B') {
+            suffix += 3;
+        } else {
+            suffix++;
+        }
+
+        while (power--) {
+            if (! multiply_checked (&n, base)) {
+                *invalid = LONGINT_OVERFLOW;
+                return UINTMAX_MAX;
+            }
+        }
+    }
+
+    // "2x512" is 2 times 512, and the right hand side can have its own x
+    if (*suffix == 'x') {
+        uintmax_t multiplier = parse_integer (suffix + 1, invalid);
+        if (! multiply_checked (&n, multiplier)) {
+            *invalid = LONGINT_OVERFLOW;
+            return UINTMAX_MAX;
+        }
+    } else if (*suffix) {
+        *invalid = LONGINT_INVALID;
+    }
+
+    return n;
+
+}
+
+// read up to size bytes from fd into buf, retrying if a signal interrupts the read
+// returns the number of bytes read, 0 at end of file, or -1 with errno set
+static ssize_t
+iread (int fd, char * buf, size_t size) {
+
+    static ssize_t prev_nread;
+    ssize_t nread;
+
+    do {
+        nread = read (fd, buf, size);
+    } while (nread < 0 && errno == EINTR);
+
+    // two short reads in a row means the input is a pipe or a terminal
+    // and count= or skip= will not mean what the user probably thinks
+    if (0 < nread && (size_t) nread < size) {
+        if (warn_partial_read && 0 < prev_nread && (size_t) prev_nread < size) {
+            if (status_level != STATUS_NONE) {
+                error (0, 0, _("warning: partial read (%"PRIuMAX" bytes); suggest iflag=fullblock"), (uintmax_t) nread);
+            }
+            warn_partial_read = false;
+        }
+    }
+
+    prev_nread = nread;
+    return nread;
+
+}
+
+// like iread, but keep reading until size bytes arrive or the input ends
+// used with iflag=fullblock, so that a record from a pipe is always a full block
+static ssize_t
+iread_fullblock (int fd, char * buf, size_t size) {
+
+    ssize_t nread = 0;
+
+    while (0 < size) {
+        ssize_t ncurr = iread (fd, buf, size);
+        if (ncurr < 0) {
+            return ncurr;
+        }
+        if (ncurr == 0) {
+            break;
+        }
+        nread += ncurr;
+        buf += ncurr;
+        size -= ncurr;
+    }
+
+    return nread;
+
+}
+
+
 
 // static here means local namespace, this scanargs name will not conflict with any other uses of scanargs
 // in other files, also cannot be called from outside of this file, kind of a file local namespace
@@ -383,6 +915,1001 @@ scanargs (int argc, char * const * argv) {
 }
 
 
+// the copy engine
+//
+// a copy is a graph of stages, which for dd is a straight line:
+//
+//   source -> [translate] -> [swab] -> [block | unblock] -> sink
+//
+// the source reads input records into buffers and pushes them into the first stage
+// each stage processes a buffer and passes it (or new buffers) on to the next one
+// the transforms in the middle are only there if conversions_mask asks for them
+// the sink collects output blocks and writes them
+//
+// a stage runs inline, called directly by the stage before it, or on its own thread
+// fed through a bounded queue of buffers, depending on how much work it does per buffer
+// either way a stage sees its buffers in order, so the output is the same
+
+// a buffer of bytes flowing between stages
+// buffers are recycled through a free list instead of being freed
+struct buffer {
+    struct buffer * next;   // link in the free list
+    char * base;            // the allocation, page aligned
+    char * data;            // the first byte, a page after base
+    size_t len;             // bytes used from data
+};
+
+// every buffer can hold this many bytes from data
+static size_t buffer_size;
+
+// buffers that are not in use
+static struct buffer * free_buffers;
+static pthread_mutex_t free_buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// get an empty buffer, allocating one if none are free
+static struct buffer *
+buffer_get (void) {
+
+    struct buffer * buf;
+
+    pthread_mutex_lock (&free_buffers_lock);
+    buf = free_buffers;
+    if (buf) {
+        free_buffers = buf->next;
+    }
+    pthread_mutex_unlock (&free_buffers_lock);
+
+    if (! buf) {
+        void * base;
+        buf = malloc (sizeof *buf);
+        if (! buf || posix_memalign (&base, page_size, INPUT_BLOCK_SLOP + buffer_size) != 0) {
+            error (EXIT_FAILURE, 0, _("memory exhausted"));
+        }
+        buf->base = base;
+    }
+
+    // data starts a page in, so it is page aligned for O_DIRECT
+    // and a stage can still put bytes in front of it (see swab_process)
+    buf->data = buf->base + page_size;
+    buf->len = 0;
+    return buf;
+
+}
+
+// give a buffer back to the free list
+static void
+buffer_put (struct buffer * buf) {
+    pthread_mutex_lock (&free_buffers_lock);
+    buf->next = free_buffers;
+    free_buffers = buf;
+    pthread_mutex_unlock (&free_buffers_lock);
+}
+
+// how many buffers can wait in front of a threaded stage
+// when the queue is full, the stage before it blocks, so memory use stays bounded
+#define QUEUE_DEPTH 4
+
+// a bounded first in first out queue of buffers
+struct queue {
+    struct buffer * slots[QUEUE_DEPTH];
+    size_t head;    // index of the oldest buffer
+    size_t count;   // number of buffers in the queue
+    bool closed;    // no more buffers will be pushed
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+static void
+queue_init (struct queue * q) {
+    q->head = q->count = 0;
+    q->closed = false;
+    pthread_mutex_init (&q->lock, NULL);
+    pthread_cond_init (&q->not_empty, NULL);
+    pthread_cond_init (&q->not_full, NULL);
+}
+
+static void
+queue_push (struct queue * q, struct buffer * buf) {
+    pthread_mutex_lock (&q->lock);
+    while (q->count == QUEUE_DEPTH) {
+        pthread_cond_wait (&q->not_full, &q->lock);
+    }
+    q->slots[(q->head + q->count) % QUEUE_DEPTH] = buf;
+    q->count++;
+    pthread_cond_signal (&q->not_empty);
+    pthread_mutex_unlock (&q->lock);
+}
+
+// take the oldest buffer, waiting for one if needed
+// returns NULL once the queue is closed and empty
+static struct buffer *
+queue_pop (struct queue * q) {
+
+    struct buffer * buf = NULL;
+
+    pthread_mutex_lock (&q->lock);
+    while (q->count == 0 && ! q->closed) {
+        pthread_cond_wait (&q->not_empty, &q->lock);
+    }
+    if (q->count) {
+        buf = q->slots[q->head];
+        q->head = (q->head + 1) % QUEUE_DEPTH;
+        q->count--;
+        pthread_cond_signal (&q->not_full);
+    }
+    pthread_mutex_unlock (&q->lock);
+
+    return buf;
+
+}
+
+static void
+queue_close (struct queue * q) {
+    pthread_mutex_lock (&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast (&q->not_empty);
+    pthread_mutex_unlock (&q->lock);
+}
+
+// roughly how much work a stage does, which decides whether it gets a thread
+enum stage_cost {
+    COST_PER_BYTE,  // looks at every byte, like translating
+    COST_IO         // waits on the kernel, like writing
+};
+
+// handing a buffer to another thread costs a few microseconds
+// so a stage only gets its own thread when a buffer is big enough to be worth more than that
+// waiting on I/O is worth overlapping sooner than per byte work is
+#define THREAD_MIN_IO_SIZE (64 * 1024)
+#define THREAD_MIN_CPU_SIZE (1024 * 1024)
+
+struct stage {
+
+    char const * name;
+    enum stage_cost cost;
+
+    // consume buf, passing it or other buffers on with stage_send or stage_output
+    void (* process) (struct stage * self, struct buffer * buf);
+
+    // called once at the end of the input, to pass on anything held back
+    // may be NULL
+    void (* finish) (struct stage * self);
+
+    // where this stage sends its buffers, NULL for the sink
+    struct stage * next;
+
+    // whether process runs on thread, fed by queue
+    bool threaded;
+    struct queue queue;
+    pthread_t thread;
+
+    // a partly filled buffer being built by stage_output
+    struct buffer * out;
+
+};
+
+static void stage_end (struct stage * stage);
+
+// hand buf to stage, either through its queue or by running it right here
+static void
+stage_push (struct stage * stage, struct buffer * buf) {
+    if (stage->threaded) {
+        queue_push (&stage->queue, buf);
+    } else {
+        stage->process (stage, buf);
+    }
+}
+
+// pass buf on to the stage after self
+static void
+stage_send (struct stage * self, struct buffer * buf) {
+    stage_push (self->next, buf);
+}
+
+// append n bytes at p to the buffer self is building, sending it on whenever it fills up
+// this is for stages whose output does not line up with their input, like block and unblock
+static void
+stage_output (struct stage * self, char const * p, size_t n) {
+
+    while (n) {
+
+        size_t chunk;
+
+        if (! self->out) {
+            self->out = buffer_get ();
+        }
+
+        chunk = MIN (n, buffer_size - self->out->len);
+        memcpy (self->out->data + self->out->len, p, chunk);
+        self->out->len += chunk;
+        p += chunk;
+        n -= chunk;
+
+        if (self->out->len == buffer_size) {
+            stage_send (self, self->out);
+            self->out = NULL;
+        }
+    }
+
+}
+
+// one byte version of stage_output, for the byte at a time conversions
+static void
+stage_output_char (struct stage * self, char c) {
+    if (! self->out) {
+        self->out = buffer_get ();
+    }
+    self->out->data[self->out->len++] = c;
+    if (self->out->len == buffer_size) {
+        stage_send (self, self->out);
+        self->out = NULL;
+    }
+}
+
+// the input has ended for self: pass on what it holds, then end the rest of the graph
+static void
+stage_finish (struct stage * self) {
+
+    if (self->finish) {
+        self->finish (self);
+    }
+
+    if (self->out) {
+        if (self->out->len) {
+            stage_send (self, self->out);
+        } else {
+            buffer_put (self->out);
+        }
+        self->out = NULL;
+    }
+
+    if (self->next) {
+        stage_end (self->next);
+    }
+
+}
+
+static void *
+stage_thread (void * arg) {
+
+    struct stage * self = arg;
+    struct buffer * buf;
+
+    while ((buf = queue_pop (&self->queue))) {
+        self->process (self, buf);
+    }
+
+    stage_finish (self);
+    return NULL;
+
+}
+
+// tell stage and everything after it that the input has ended, and wait for them to finish
+static void
+stage_end (struct stage * stage) {
+    if (stage->threaded) {
+        queue_close (&stage->queue);
+        pthread_join (stage->thread, NULL);
+    } else {
+        stage_finish (stage);
+    }
+}
+
+// the translate stage: map every byte through trans_table, in place
+static void
+translate_process (struct stage * self, struct buffer * buf) {
+
+    unsigned char * p = (unsigned char *) buf->data;
+    size_t i;
+
+    for (i = 0; i < buf->len; i++) {
+        p[i] = trans_table[p[i]];
+    }
+
+    stage_send (self, buf);
+
+}
+
+// the swab stage: swap every pair of bytes, in place
+// a byte left over from an odd sized buffer is carried into the front of the next one
+static bool char_is_saved = false;
+static char saved_char;
+
+static void
+swab_process (struct stage * self, struct buffer * buf) {
+
+    size_t i;
+    char c;
+
+    // there is a page in front of data, so there is room for it
+    if (char_is_saved) {
+        *--buf->data = saved_char;
+        buf->len++;
+        char_is_saved = false;
+    }
+
+    if (buf->len & 1) {
+        saved_char = buf->data[--buf->len];
+        char_is_saved = true;
+    }
+
+    if (buf->len == 0) {
+        buffer_put (buf);
+        return;
+    }
+
+    for (i = 0; i < buf->len; i += 2) {
+        c = buf->data[i];
+        buf->data[i] = buf->data[i + 1];
+        buf->data[i + 1] = c;
+    }
+
+    stage_send (self, buf);
+
+}
+
+// a byte left at the end of an odd sized input goes out unswapped
+static void
+swab_finish (struct stage * self) {
+    if (char_is_saved) {
+        stage_output (self, &saved_char, 1);
+    }
+}
+
+/* Index into current line, for 'conv=block' and 'conv=unblock'.  */
+static size_t col = 0;
+
+// the block stage: turn newline terminated lines into records of conversion_blocksize bytes
+// short lines are padded with spaces, long ones are truncated
+static void
+block_process (struct stage * self, struct buffer * buf) {
+
+    char const * p = buf->data;
+    size_t i, j;
+
+    for (i = 0; i < buf->len; i++) {
+        if (p[i] == newline_character) {
+            for (j = col; j < conversion_blocksize; j++) {
+                stage_output_char (self, space_character);
+            }
+            col = 0;
+        } else {
+            if (col == conversion_blocksize) {
+                r_truncate++;
+            } else if (col < conversion_blocksize) {
+                stage_output_char (self, p[i]);
+            }
+            col++;
+        }
+    }
+
+    buffer_put (buf);
+
+}
+
+/* If the final input line didn't end with a '\n', pad
+   the output block to 'conversion_blocksize' chars.  */
+static void
+block_finish (struct stage * self) {
+
+    size_t i;
+
+    if (col > 0) {
+        for (i = col; i < conversion_blocksize; i++) {
+            stage_output_char (self, space_character);
+        }
+    }
+
+}
+
+// spaces seen in the current record of unblock, only written if something other than spaces follows
+static size_t pending_spaces = 0;
+
+// the unblock stage: turn records of conversion_blocksize bytes into lines
+// trailing spaces are dropped and a newline is added to each record
+static void
+unblock_process (struct stage * self, struct buffer * buf) {
+
+    char const * p = buf->data;
+    size_t i;
+
+    for (i = 0; i < buf->len; i++) {
+        char c = p[i];
+        if (col++ >= conversion_blocksize) {
+            col = pending_spaces = 0; /* Wipe out any pending spaces.  */
+            i--;                      /* Push the char back; get it later. */
+            stage_output_char (self, newline_character);
+        } else if (c == space_character) {
+            pending_spaces++;
+        } else {
+            /* 'c' is the character after a run of spaces that were not
+               at the end of the conversion buffer.  Output them.  */
+            while (pending_spaces) {
+                stage_output_char (self, space_character);
+                --pending_spaces;
+            }
+            stage_output_char (self, c);
+        }
+    }
+
+    buffer_put (buf);
+
+}
+
+/* If there was any output, add a final '\n'.  */
+static void
+unblock_finish (struct stage * self) {
+    if (col) {
+        stage_output_char (self, newline_character);
+    }
+}
+
+// true if all n bytes at buf are zero
+static bool
+is_nul (char const * buf, size_t n) {
+    return n == 0 || (buf[0] == 0 && memcmp (buf, buf + 1, n - 1) == 0);
+}
+
+// write n bytes from buf to fd, retrying interrupted and short writes
+// with conv=sparse a block of zeros becomes a seek instead, leaving a hole
+// returns the number of bytes written, which is less than n only on error
+static size_t
+iwrite (int fd, char const * buf, size_t n) {
+
+    size_t total = 0;
+
+    if ((conversions_mask & C_SPARSE) && is_nul (buf, n)) {
+        if (lseek (fd, n, SEEK_CUR) < 0) {
+            // can't seek on this output, so write the zeros after all
+            conversions_mask &= ~C_SPARSE;
+        } else {
+            final_op_was_seek = true;
+            return n;
+        }
+    }
+
+    final_op_was_seek = false;
+
+    while (total < n) {
+        ssize_t nwritten = write (fd, buf + total, n - total);
+        if (nwritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (nwritten == 0) {
+            // a write of 0 bytes makes no progress, treat it as a full device
+            errno = ENOSPC;
+            break;
+        }
+        total += nwritten;
+    }
+
+    return total;
+
+}
+
+// the output block being filled by the sink, when conv= needs separate buffers
+static char * obuf;
+
+// bytes used in obuf
+static size_t oc = 0;
+
+// write a block of n bytes, counting it as a full or partial record
+static void
+write_block (char const * buf, size_t n, bool full) {
+
+    size_t nwritten = iwrite (STDOUT_FILENO, buf, n);
+
+    w_bytes += nwritten;
+    if (nwritten != n) {
+        error (EXIT_FAILURE, errno, _("error writing %s"), quote (output_file));
+    }
+
+    if (full) {
+        w_full++;
+    } else {
+        w_partial++;
+    }
+
+}
+
+// the sink stage: write the data out
+// without C_TWOBUFS every input record is written as it is, like dd if=x of=y bs=N
+// with C_TWOBUFS the data is regrouped into blocks of output_blocksize
+static void
+sink_process (struct stage * self, struct buffer * buf) {
+
+    char const * p = buf->data;
+    size_t n = buf->len;
+
+    (void) self;
+
+    if (! (conversions_mask & C_TWOBUFS)) {
+        write_block (p, n, n == input_blocksize);
+        buffer_put (buf);
+        return;
+    }
+
+    while (n) {
+
+        size_t chunk;
+
+        // with nothing pending and a whole block in hand, write it straight from buf
+        // rather than copying it into obuf first, unless O_DIRECT needs an aligned address
+        if (oc == 0 && output_blocksize <= n
+            && (! (output_flags & O_DIRECT) || (uintptr_t) p % page_size == 0)) {
+            write_block (p, output_blocksize, true);
+            p += output_blocksize;
+            n -= output_blocksize;
+            continue;
+        }
+
+        chunk = MIN (n, output_blocksize - oc);
+        memcpy (obuf + oc, p, chunk);
+        oc += chunk;
+        p += chunk;
+        n -= chunk;
+
+        if (oc == output_blocksize) {
+            write_block (obuf, oc, true);
+            oc = 0;
+        }
+    }
+
+    buffer_put (buf);
+
+}
+
+static void
+sink_finish (struct stage * self) {
+
+    (void) self;
+
+    /* Write out the last block. */
+    if (oc != 0) {
+        write_block (obuf, oc, false);
+        oc = 0;
+    }
+
+    /* If the last write was converted to a seek, then for a regular file,
+       ftruncate to extend the size.  */
+    if (final_op_was_seek) {
+        struct stat stdout_stat;
+        off_t output_offset;
+        if (fstat (STDOUT_FILENO, &stdout_stat) != 0) {
+            error (EXIT_FAILURE, errno, _("cannot fstat %s"), quote (output_file));
+        }
+        output_offset = lseek (STDOUT_FILENO, 0, SEEK_CUR);
+        if (S_ISREG (stdout_stat.st_mode) && 0 <= output_offset
+            && stdout_stat.st_size < output_offset
+            && ftruncate (STDOUT_FILENO, output_offset) != 0) {
+            error (EXIT_FAILURE, errno, _("failed to truncate to %"PRIdMAX" bytes in output file %s"),
+                   (intmax_t) output_offset, quote (output_file));
+        }
+    }
+
+}
+
+// the stages, in the order data flows through them
+static struct stage translate_stage = {
+    .name = "translate", .cost = COST_PER_BYTE, .process = translate_process
+};
+static struct stage swab_stage = {
+    .name = "swab", .cost = COST_PER_BYTE, .process = swab_process, .finish = swab_finish
+};
+static struct stage block_stage = {
+    .name = "block", .cost = COST_PER_BYTE, .process = block_process, .finish = block_finish
+};
+static struct stage unblock_stage = {
+    .name = "unblock", .cost = COST_PER_BYTE, .process = unblock_process, .finish = unblock_finish
+};
+static struct stage sink_stage = {
+    .name = "sink", .cost = COST_IO, .process = sink_process, .finish = sink_finish
+};
+
+// whether a stage of this cost is worth its own thread, given buffer_size
+static bool
+worth_a_thread (enum stage_cost cost) {
+    switch (cost) {
+    case COST_IO:
+        return THREAD_MIN_IO_SIZE <= buffer_size;
+    case COST_PER_BYTE:
+        return THREAD_MIN_CPU_SIZE <= buffer_size;
+    }
+    return false;
+}
+
+// link up the stages that conversions_mask asks for, and start the threaded ones
+// returns the first stage, for the source to push into
+static struct stage *
+build_graph (void) {
+
+    struct stage * stages[5];
+    size_t n = 0;
+    size_t i;
+
+    // the same order gnu dd applies them: translate, then swab, then reblock
+    if (translation_needed) {
+        stages[n++] = &translate_stage;
+    }
+    if (conversions_mask & C_SWAB) {
+        stages[n++] = &swab_stage;
+    }
+    if (conversions_mask & C_BLOCK) {
+        stages[n++] = &block_stage;
+    } else if (conversions_mask & C_UNBLOCK) {
+        stages[n++] = &unblock_stage;
+    }
+    stages[n++] = &sink_stage;
+
+    if (conversions_mask & C_TWOBUFS) {
+        void * p;
+        if (posix_memalign (&p, page_size, output_blocksize) != 0) {
+            error (EXIT_FAILURE, 0, _("memory exhausted"));
+        }
+        obuf = p;
+    }
+
+    // start from the sink, so each thread only ever pushes into a stage that is ready
+    for (i = n; i-- > 0; ) {
+        stages[i]->next = i + 1 < n ? stages[i + 1] : NULL;
+        stages[i]->threaded = false;
+        if (worth_a_thread (stages[i]->cost)) {
+            queue_init (&stages[i]->queue);
+            // without a thread the stage still works, just inline
+            stages[i]->threaded = pthread_create (&stages[i]->thread, NULL, stage_thread, stages[i]) == 0;
+        }
+    }
+
+    return stages[0];
+
+}
+
+// the source: read the input a record at a time and push the records into the graph
+// this runs on the main thread and drives everything else
+// returns EXIT_FAILURE after a read error, EXIT_SUCCESS otherwise
+static int
+read_input (struct stage * first) {
+
+    int exit_status = EXIT_SUCCESS;
+
+    // conv=sync pads short records with this, spaces when making text records
+    char fill = (conversions_mask & (C_BLOCK | C_UNBLOCK)) ? ' ' : '\0';
+
+    while (r_partial + r_full < max_records + !!max_bytes) {
+
+        struct buffer * buf = buffer_get ();
+        size_t size = r_partial + r_full < max_records ? input_blocksize : max_bytes;
+        ssize_t nread;
+
+        /* Zero the buffer before reading, so that if we get a read error,
+           whatever data we are able to read is followed by zeros.  */
+        if ((conversions_mask & C_SYNC) && (conversions_mask & C_NOERROR)) {
+            memset (buf->data, fill, input_blocksize);
+        }
+
+        nread = iread_fnc (STDIN_FILENO, buf->data, size);
+
+        if (nread == 0) {
+            buffer_put (buf);
+            break;
+        }
+
+        if (nread < 0) {
+
+            if (! (conversions_mask & C_NOERROR) || status_level != STATUS_NONE) {
+                error (0, errno, _("error reading %s"), quote (input_file));
+            }
+
+            if (! (conversions_mask & C_NOERROR)) {
+                // stop reading, but still write out what is already in the graph
+                buffer_put (buf);
+                exit_status = EXIT_FAILURE;
+                break;
+            }
+
+            // skip over the bad block, which only works if the input can seek
+            if (input_seekable && lseek (STDIN_FILENO, input_blocksize, SEEK_CUR) < 0) {
+                error (0, errno, _("%s: cannot seek"), quote (input_file));
+                input_seekable = false;
+                exit_status = EXIT_FAILURE;
+            }
+
+            if (! (conversions_mask & C_SYNC)) {
+                buffer_put (buf);
+                continue;
+            }
+
+            /* Replace the missing input with null bytes and
+               proceed normally.  */
+            nread = 0;
+        }
+
+        buf->len = nread;
+
+        if (buf->len < input_blocksize) {
+            r_partial++;
+            if (conversions_mask & C_SYNC) {
+                if (! (conversions_mask & C_NOERROR)) {
+                    memset (buf->data + buf->len, fill, input_blocksize - buf->len);
+                }
+                buf->len = input_blocksize;
+            }
+        } else {
+            r_full++;
+        }
+
+        stage_push (first, buf);
+    }
+
+    return exit_status;
+
+}
+
+/* Translation table formed by applying successive transformations. */
+static void
+translate_charset (char const * new_trans) {
+
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        trans_table[i] = new_trans[trans_table[i]];
+    }
+    translation_needed = true;
+
+}
+
+/* Fix up translation table. */
+static void
+apply_translations (void) {
+
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        trans_table[i] = i;
+    }
+
+    if (conversions_mask & C_ASCII) {
+        translate_charset (ebcdic_to_ascii);
+    }
+
+    if (conversions_mask & C_UCASE) {
+        for (i = 0; i < 256; i++) {
+            trans_table[i] = toupper (trans_table[i]);
+        }
+        translation_needed = true;
+    } else if (conversions_mask & C_LCASE) {
+        for (i = 0; i < 256; i++) {
+            trans_table[i] = tolower (trans_table[i]);
+        }
+        translation_needed = true;
+    }
+
+    if (conversions_mask & C_EBCDIC) {
+        translate_charset (ascii_to_ebcdic);
+        newline_character = ascii_to_ebcdic['\n'];
+        space_character = ascii_to_ebcdic[' '];
+    } else if (conversions_mask & C_IBM) {
+        translate_charset (ascii_to_ibm);
+        newline_character = ascii_to_ibm['\n'];
+        space_character = ascii_to_ibm[' '];
+    }
+
+}
+
+// open file on desired_fd, like gnulib's fd_reopen
+static int
+open_fd (int desired_fd, char const * file, int flags, mode_t mode) {
+
+    int fd;
+
+    close (desired_fd);
+    fd = open (file, flags, mode);
+    if (fd == desired_fd || fd < 0) {
+        return fd;
+    } else {
+        int fd2 = dup2 (fd, desired_fd);
+        int saved_errno = errno;
+        close (fd);
+        errno = saved_errno;
+        return fd2;
+    }
+
+}
+
+// add flags to an already open fd, for when the input or output is stdin or stdout
+static void
+set_fd_flags (int fd, int add_flags, char const * name) {
+
+    // these only make sense when opening
+    add_flags &= ~(O_NOCTTY | O_NOFOLLOW | O_PRIVATE);
+
+    if (add_flags) {
+        int old_flags = fcntl (fd, F_GETFL);
+        int new_flags = old_flags | add_flags;
+        if (old_flags < 0
+            || (new_flags != old_flags && fcntl (fd, F_SETFL, new_flags) == -1)) {
+            error (EXIT_FAILURE, errno, _("setting flags for %s"), quote (name));
+        }
+    }
+
+}
+
+// the byte offset of records blocks of blocksize bytes plus bytes
+static off_t
+blocks_to_offset (uintmax_t records, size_t blocksize, size_t bytes, char const * name) {
+    if ((uintmax_t) (OFF_T_MAX - bytes) / blocksize < records) {
+        error (EXIT_FAILURE, EOVERFLOW, _("%s: cannot seek"), quote (name));
+    }
+    return records * blocksize + bytes;
+}
+
+static void
+open_files (void) {
+
+    if (input_file == NULL) {
+        input_file = _("standard input");
+        set_fd_flags (STDIN_FILENO, input_flags, input_file);
+    } else if (open_fd (STDIN_FILENO, input_file, O_RDONLY | (input_flags & ~O_PRIVATE), 0) < 0) {
+        error (EXIT_FAILURE, errno, _("failed to open %s"), quote (input_file));
+    }
+
+    input_seekable = 0 <= lseek (STDIN_FILENO, 0, SEEK_CUR);
+
+    if (output_file == NULL) {
+        output_file = _("standard output");
+        set_fd_flags (STDOUT_FILENO, output_flags, output_file);
+    } else {
+
+        mode_t perms = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+        int opts = ((output_flags & ~O_PRIVATE)
+                    | (conversions_mask & C_NOCREAT ? 0 : O_CREAT)
+                    | (conversions_mask & C_EXCL ? O_EXCL : 0)
+                    | (seek_records || (conversions_mask & C_NOTRUNC) ? 0 : O_TRUNC));
+
+        /* Open the output file with *read* access only if we might
+           need to read to satisfy a 'seek=' request.  If we can't read
+           the file, go ahead with write-only access; it might work.  */
+        if ((! seek_records
+             || open_fd (STDOUT_FILENO, output_file, O_RDWR | opts, perms) < 0)
+            && open_fd (STDOUT_FILENO, output_file, O_WRONLY | opts, perms) < 0) {
+            error (EXIT_FAILURE, errno, _("failed to open %s"), quote (output_file));
+        }
+
+        if (seek_records != 0 && ! (conversions_mask & C_NOTRUNC)) {
+            off_t size = blocks_to_offset (seek_records, output_blocksize, seek_bytes, output_file);
+            struct stat stdout_stat;
+            // POSIX only specifies ftruncate for regular files, so only complain about those
+            if (ftruncate (STDOUT_FILENO, size) != 0
+                && fstat (STDOUT_FILENO, &stdout_stat) == 0
+                && S_ISREG (stdout_stat.st_mode)) {
+                error (EXIT_FAILURE, errno, _("failed to truncate to %"PRIdMAX" bytes in output file %s"),
+                       (intmax_t) size, quote (output_file));
+            }
+        }
+    }
+
+}
+
+// skip= on the input: seek if possible, otherwise read and throw records away
+static void
+skip_input (void) {
+
+    struct buffer * buf;
+
+    if (skip_records == 0 && skip_bytes == 0) {
+        return;
+    }
+
+    if (input_seekable) {
+        off_t offset = blocks_to_offset (skip_records, input_blocksize, skip_bytes, input_file);
+        if (0 <= lseek (STDIN_FILENO, offset, SEEK_CUR)) {
+            return;
+        }
+    }
+
+    buf = buffer_get ();
+
+    while (skip_records || skip_bytes) {
+
+        size_t size = skip_records ? input_blocksize : skip_bytes;
+        ssize_t nread = iread_fnc (STDIN_FILENO, buf->data, size);
+
+        if (nread < 0) {
+            error (EXIT_FAILURE, errno, _("error reading %s"), quote (input_file));
+        }
+        if (nread == 0) {
+            if (status_level != STATUS_NONE) {
+                error (0, 0, _("%s: cannot skip to specified offset"), quote (input_file));
+            }
+            break;
+        }
+
+        if (skip_records) {
+            skip_records--;
+        } else {
+            skip_bytes = 0;
+        }
+    }
+
+    buffer_put (buf);
+
+}
+
+// seek= on the output
+static void
+seek_output (void) {
+
+    off_t offset;
+
+    if (seek_records == 0 && seek_bytes == 0) {
+        return;
+    }
+
+    offset = blocks_to_offset (seek_records, output_blocksize, seek_bytes, output_file);
+    if (lseek (STDOUT_FILENO, offset, SEEK_CUR) < 0) {
+        error (EXIT_FAILURE, errno, _("%s: cannot seek"), quote (output_file));
+    }
+
+}
+
+/* Synchronize the output as conv=fdatasync or conv=fsync ask.  */
+static int
+synchronize_output (void) {
+
+    int exit_status = EXIT_SUCCESS;
+    int mask = conversions_mask;
+
+    // some files, like pipes, can't do fdatasync but may still do fsync
+    if ((mask & C_FDATASYNC) && fdatasync (STDOUT_FILENO) != 0) {
+        if (errno != ENOSYS && errno != EINVAL) {
+            error (0, errno, _("fdatasync failed for %s"), quote (output_file));
+            exit_status = EXIT_FAILURE;
+        }
+        mask |= C_FSYNC;
+    }
+
+    if ((mask & C_FSYNC) && fsync (STDOUT_FILENO) != 0) {
+        error (0, errno, _("fsync failed for %s"), quote (output_file));
+        return EXIT_FAILURE;
+    }
+
+    return exit_status;
+
+}
+
+// print the records in and out, like gnu dd does at the end
+static void
+print_stats (double seconds) {
+
+    if (status_level == STATUS_NONE) {
+        return;
+    }
+
+    fprintf (stderr,
+             _("%"PRIuMAX"+%"PRIuMAX" records in\n"
+               "%"PRIuMAX"+%"PRIuMAX" records out\n"),
+             r_full, r_partial, w_full, w_partial);
+
+    if (r_truncate != 0) {
+        fprintf (stderr, r_truncate == 1 ? _("%"PRIuMAX" truncated record\n") : _("%"PRIuMAX" truncated records\n"),
+                 r_truncate);
+    }
+
+    if (status_level == STATUS_NOXFER) {
+        return;
+    }
+
+    fprintf (stderr, _("%"PRIuMAX" bytes copied, %g s, %g B/s\n"),
+             w_bytes, seconds, 0 < seconds ? w_bytes / seconds : 0);
+
+}
+
+
+
 
 
 
@@ -397,9 +1924,9 @@ scanargs (int argc, char * const * argv) {
 // there's also --key=value but that's not by default
 int main (int argc, char * * argv) {
 
-    // default 512 bytes
-
-    puts("Hello!");
+    int exit_status;
+    struct stage * graph;
+    struct timespec start_time, end_time;
 
     // assigns it statically
     // gets the memory page size
@@ -408,9 +1935,9 @@ int main (int argc, char * * argv) {
     // this is the number of bytes
     page_size = sysconf (_SC_PAGESIZE);
 
-    // if getopt_long == 1, then the argv contains gnu style options (shortopts and longopts)
+    // if getopt_long doesn't return -1, then the argv contains gnu style options (shortopts and longopts)
     // this is wrong, so we exit, because dd does not accept gnu style options, it has its own stule
-    if (getopt_long (argc, argv, "", NULL, NULL)) {
+    if (getopt_long (argc, argv, "", NULL, NULL) != -1) {
         puts ("Incorrect Options! Do not use GNU style options");
         return EXIT_FAILURE;
     }
@@ -418,11 +1945,44 @@ int main (int argc, char * * argv) {
     // process dd specific style options (if=.. of=..)
     scanargs (argc, argv);
 
+    apply_translations ();
+
+    // every buffer in the graph is big enough for an input record or an output block
+    buffer_size = MAX (input_blocksize, output_blocksize);
+
+    open_files ();
+    skip_input ();
+    seek_output ();
+
+    clock_gettime (CLOCK_MONOTONIC, &start_time);
 
+    graph = build_graph ();
+    exit_status = read_input (graph);
 
+    // flush every stage, in order, and wait for their threads
+    stage_end (graph);
 
+    if ((conversions_mask & (C_FDATASYNC | C_FSYNC))
+        && synchronize_output () != EXIT_SUCCESS) {
+        exit_status = EXIT_FAILURE;
+    }
 
+    // nocache drops whatever was cached of the files, now that they are copied
+    if (i_nocache) {
+        posix_fadvise (STDIN_FILENO, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    if (o_nocache) {
+        posix_fadvise (STDOUT_FILENO, 0, 0, POSIX_FADV_DONTNEED);
+    }
 
-    return EXIT_SUCCESS;
+    if (close (STDOUT_FILENO) != 0) {
+        error (EXIT_FAILURE, errno, _("closing output file %s"), quote (output_file));
+    }
 
-}
\ No newline at end of file
+    clock_gettime (CLOCK_MONOTONIC, &end_time);
+    print_stats ((end_time.tv_sec - start_time.tv_sec)
+                 + (end_time.tv_nsec - start_time.tv_nsec) / 1e9);
+
+    return exit_status;
+
+}